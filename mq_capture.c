@@ -0,0 +1,191 @@
+/*
+ * mq_capture.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "mq_capture.h"
+#include "mq_clock.h"
+#include "mq_log.h"
+
+static int capture_map (MqCapture* cap, const char* path) {
+
+	int prot = cap->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	void* p = mmap (0, cap->map_size, prot, MAP_SHARED, cap->fd, 0);
+
+	if (p == MAP_FAILED) {
+		mq_log_error ("Capture file '%s' cannot be mapped: %s", path, strerror (errno));
+		return -1;
+	}
+	cap->hdr = (MqCaptureHeader*) p;
+	cap->records = (MqCaptureRecord*) ((char*) p + MQ_CAPTURE_DATA_OFFSET);
+	return 0;
+}
+
+int mq_capture_create (MqCapture* cap, const char* path, uint64_t capacity, const char* source, const char* clock) {
+
+	int result = 0;
+
+	memset (cap, 0, sizeof(MqCapture));
+	cap->fd = -1;
+	cap->writable = 1;
+	if (capacity == 0) {
+		mq_log_error ("Capture file must have room for at least one record");
+		return -1;
+	}
+	cap->fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (cap->fd == -1) {
+		mq_log_error ("Capture file '%s' cannot be created: %s", path, strerror (errno));
+		return -1;
+	}
+	cap->map_size = MQ_CAPTURE_DATA_OFFSET + capacity * sizeof(MqCaptureRecord);
+#ifdef MOSQ_LINUX
+	// allocate the blocks now; a full disk must not show up as SIGBUS in the middle of a run
+	result = posix_fallocate (cap->fd, 0, cap->map_size);
+#else
+	result = ftruncate (cap->fd, cap->map_size) == -1 ? errno : 0;
+#endif
+	if (result != 0) {
+		mq_log_error ("Capture file '%s' cannot be allocated (%llu bytes): %s", path,
+				(unsigned long long) cap->map_size, strerror (result));
+		close (cap->fd);
+		cap->fd = -1;
+		return -1;
+	}
+	if (capture_map (cap, path) == -1) {
+		close (cap->fd);
+		cap->fd = -1;
+		return -1;
+	}
+	memcpy (cap->hdr->magic, MQ_CAPTURE_MAGIC, sizeof(MQ_CAPTURE_MAGIC));
+	cap->hdr->version = MQ_CAPTURE_VERSION;
+	cap->hdr->byte_order = MQ_CAPTURE_BYTE_ORDER;
+	cap->hdr->record_size = sizeof(MqCaptureRecord);
+	cap->hdr->capacity = capacity;
+	cap->hdr->created = mq_clock_now ();
+	strncpy (cap->hdr->source, source, sizeof(cap->hdr->source) - 1);
+	strncpy (cap->hdr->clock, clock, sizeof(cap->hdr->clock) - 1);
+	strcpy (cap->hdr->topics[MQ_CAPTURE_OTHER_TOPIC], "(other)");
+	return 0;
+}
+
+int mq_capture_open (MqCapture* cap, const char* path) {
+
+	struct stat st;
+	MqCaptureHeader hdr;
+
+	memset (cap, 0, sizeof(MqCapture));
+	cap->fd = open (path, O_RDONLY);
+	if (cap->fd == -1) {
+		mq_log_error ("Capture file '%s' cannot be opened: %s", path, strerror (errno));
+		return -1;
+	}
+	if (fstat (cap->fd, &st) == -1 || read (cap->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		mq_log_error ("Capture file '%s' cannot be read", path);
+		goto error;
+	}
+	if (memcmp (hdr.magic, MQ_CAPTURE_MAGIC, sizeof(MQ_CAPTURE_MAGIC)) != 0) {
+		mq_log_error ("'%s' is not a capture file", path);
+		goto error;
+	}
+	if (hdr.version != MQ_CAPTURE_VERSION || hdr.byte_order != MQ_CAPTURE_BYTE_ORDER ||
+		hdr.record_size != sizeof(MqCaptureRecord)) {
+		mq_log_error ("Capture file '%s' is of version %u, record size %u; written on another architecture?",
+				path, hdr.version, hdr.record_size);
+		goto error;
+	}
+	cap->map_size = st.st_size;
+	// the file is shorter than count if the writer could not close it
+	if (MQ_CAPTURE_DATA_OFFSET + hdr.count * sizeof(MqCaptureRecord) > cap->map_size) {
+		mq_log_error ("Capture file '%s' is truncated", path);
+		goto error;
+	}
+	if (capture_map (cap, path) == -1) {
+		goto error;
+	}
+	cap->count = hdr.count;
+	cap->dropped = hdr.dropped;
+	return 0;
+
+error:
+	close (cap->fd);
+	cap->fd = -1;
+	return -1;
+}
+
+int mq_capture_close (MqCapture* cap) {
+
+	int result = 0;
+
+	if (cap->fd == -1 || !cap->hdr) return 0;
+	if (cap->writable) {
+		cap->hdr->dropped = cap->dropped;
+		if (msync (cap->hdr, cap->map_size, MS_SYNC) == -1) {
+			mq_log_error ("Capture file cannot be flushed: %s", strerror (errno));
+			result = -1;
+		}
+	}
+	munmap (cap->hdr, cap->map_size);
+	cap->hdr = 0;
+	cap->records = 0;
+	// give the unused room back
+	if (cap->writable && ftruncate (cap->fd, MQ_CAPTURE_DATA_OFFSET + cap->count * sizeof(MqCaptureRecord)) == -1) {
+		mq_log_error ("Capture file cannot be truncated: %s", strerror (errno));
+		result = -1;
+	}
+	close (cap->fd);
+	cap->fd = -1;
+	return result;
+}
+
+int mq_capture_topic (MqCapture* cap, const char* topic) {
+
+	uint32_t h = 2166136261u; // FNV-1a
+	const char* c = 0;
+	int index = 0;
+	int i = 0;
+
+	for (c = topic; *c; c++) {
+		h = (h ^ (unsigned char) *c) * 16777619u;
+	}
+	for (i = h & (MQ_CAPTURE_TOPIC_SLOTS - 1); cap->topic_slots[i]; i = (i + 1) & (MQ_CAPTURE_TOPIC_SLOTS - 1)) {
+		index = cap->topic_slots[i] - 1;
+		if (strncmp (cap->hdr->topics[index], topic, MQ_CAPTURE_TOPIC_LEN - 1) == 0) break;
+	}
+	if (cap->topic_slots[i]) {
+		index = cap->topic_slots[i] - 1;
+	} else if (cap->hdr->num_topics < MQ_CAPTURE_OTHER_TOPIC) {
+		index = cap->hdr->num_topics++;
+		strncpy (cap->hdr->topics[index], topic, MQ_CAPTURE_TOPIC_LEN - 1);
+		cap->topic_slots[i] = index + 1;
+	} else {
+		index = MQ_CAPTURE_OTHER_TOPIC;
+	}
+	return index;
+}
+
+void mq_capture_record_set (MqCaptureRecord* rec, const MqMessageHeader* h, uint32_t subscriber, int len,
+		int64_t rxtime, int64_t rxtime_tx) {
+	memset (rec, 0, sizeof(MqCaptureRecord));
+	rec->producer = mq_message_producer (h);
+	rec->subscriber = subscriber;
+	rec->seq = mq_message_seq (h);
+	rec->txtime = mq_message_txtime (h);
+	rec->intended_txtime = mq_message_intended_txtime (h);
+	rec->rxtime = rxtime;
+	rec->rxtime_tx = rxtime_tx;
+	rec->len = len;
+	rec->phase = mq_message_phase (h);
+	rec->flags = mq_message_flags (h);
+}
@@ -0,0 +1,127 @@
+/*
+ * mq_capture.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_CAPTURE_H_
+#define MQ_CAPTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mq_message.h"
+
+#define MQ_CAPTURE_MAGIC "MQCAPT"
+#define MQ_CAPTURE_VERSION 1
+#define MQ_CAPTURE_BYTE_ORDER 0x01020304u // the file is in the writer's byte order
+
+#define MQ_CAPTURE_MAX_TOPICS 256
+#define MQ_CAPTURE_TOPIC_LEN 128
+#define MQ_CAPTURE_OTHER_TOPIC (MQ_CAPTURE_MAX_TOPICS - 1) // topics that did not fit
+#define MQ_CAPTURE_DEFAULT_RECORDS (16 * 1024 * 1024)     // 1 GiB
+
+/**
+ * a received message; 64 bytes, host byte order. times are nsec since the
+ * epoch, rxtime in the consumer's clock, rxtime_tx the same instant in the
+ * producer's clock (equal w/o clock offset estimation). rxtime is taken in
+ * the message callback, kernel_rxtime when the kernel received it (-K)
+ */
+typedef struct MqCaptureRecord {
+	uint32_t producer;
+	uint32_t subscriber;
+	uint64_t seq;
+	int64_t txtime;
+	int64_t intended_txtime;
+	int64_t rxtime;
+	int64_t rxtime_tx;
+	uint32_t len;        // payload bytes
+	uint16_t topic;      // index into the topics of the header
+	uint8_t phase;
+	uint8_t flags;       // MQ_MESSAGE_FLAG_*
+	int64_t kernel_rxtime; // kernel rx stamp in the consumer's clock, 0 if not taken
+} MqCaptureRecord;
+
+/**
+ * head of a capture file; the records start at MQ_CAPTURE_DATA_OFFSET
+ */
+typedef struct MqCaptureHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t record_size;
+	uint32_t num_topics;
+	uint64_t capacity;   // records the file has room for
+	uint64_t count;      // records written; updated w/ every record
+	int64_t dropped;     // records that did not fit
+	int64_t created;     // nsec since the epoch
+	char source[64];     // the writer, e.g. mqconsumer
+	char clock[16];
+	char topics[MQ_CAPTURE_MAX_TOPICS][MQ_CAPTURE_TOPIC_LEN];
+} MqCaptureHeader;
+
+#define MQ_CAPTURE_DATA_OFFSET ((sizeof(MqCaptureHeader) + 4095) & ~((size_t) 4095))
+
+#define MQ_CAPTURE_TOPIC_SLOTS (2 * MQ_CAPTURE_MAX_TOPICS)
+
+/**
+ * a capture file mapped into memory.
+ *
+ * the writer creates the file at its full size up front and maps it, so
+ * capturing a message is a store of a record into the mapping and never a
+ * system call; the kernel writes the pages back in the background and what
+ * was captured survives a crash of the writer. a capture has one writer
+ * thread. when the file is full further records are only counted.
+ */
+typedef struct MqCapture {
+	int fd;
+	int writable;
+	size_t map_size;
+	MqCaptureHeader* hdr;      // the mapping
+	MqCaptureRecord* records;
+	uint64_t count;
+	int64_t dropped;
+	int topic_slots[MQ_CAPTURE_TOPIC_SLOTS]; // topic index + 1, writer only
+} MqCapture;
+
+/**
+ * creates (or truncates) path w/ room for capacity records. returns -1 on error
+ */
+int mq_capture_create (MqCapture* cap, const char* path, uint64_t capacity, const char* source, const char* clock);
+
+/**
+ * maps an existing capture file read only. returns -1 on error
+ */
+int mq_capture_open (MqCapture* cap, const char* path);
+
+/**
+ * flushes the records, shrinks the file to them and unmaps it. returns -1 on error
+ */
+int mq_capture_close (MqCapture* cap);
+
+/**
+ * index of the topic in the header, added if it is new;
+ * MQ_CAPTURE_OTHER_TOPIC once the header is full
+ */
+int mq_capture_topic (MqCapture* cap, const char* topic);
+
+static inline const char* mq_capture_topic_name (const MqCapture* cap, int index) {
+	return cap->hdr->topics[index];
+}
+
+/**
+ * fills rec from the wire header of a received message
+ */
+void mq_capture_record_set (MqCaptureRecord* rec, const MqMessageHeader* h, uint32_t subscriber, int len,
+		int64_t rxtime, int64_t rxtime_tx);
+
+static inline void mq_capture_append (MqCapture* cap, const MqCaptureRecord* rec) {
+	if (cap->count == cap->hdr->capacity) {
+		cap->dropped++;
+		return;
+	}
+	cap->records[cap->count++] = *rec;
+	cap->hdr->count = cap->count;
+}
+
+#endif /* MQ_CAPTURE_H_ */
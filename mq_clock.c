@@ -0,0 +1,162 @@
+/*
+ * mq_clock.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mq_clock.h"
+#include "mq_log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define MQ_CLOCK_HAS_TSC 1
+  #include <cpuid.h>
+  #include <x86intrin.h>
+#endif
+
+#ifdef CLOCK_MONOTONIC_RAW
+  #define MQ_CLOCK_MONOTONIC_ID CLOCK_MONOTONIC_RAW
+#else
+  #define MQ_CLOCK_MONOTONIC_ID CLOCK_MONOTONIC
+#endif
+
+#define MQ_CLOCK_OVERHEAD_READS 100000
+
+static MqClockSource mq_clock_source = MQ_CLOCK_REALTIME;
+static int64_t mq_clock_anchor_nsec = 0; // realtime - source at init
+static double mq_clock_overhead = 0.0;
+
+static uint64_t mq_clock_tsc0 = 0;
+static int64_t mq_clock_tsc0_nsec = 0;   // epoch nsec at tsc0
+static double mq_clock_nsec_per_tick = 0.0;
+
+static const char* mq_clock_names[] = {"realtime", "monotonic", "tsc"};
+
+
+static int64_t clock_read (clockid_t id) {
+	struct timespec ts = {0,0};
+	clock_gettime (id, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef MQ_CLOCK_HAS_TSC
+/* cpuid 0x80000007 edx bit 8: tsc runs at a constant rate in every P/C state */
+static int tsc_invariant () {
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+	if (!__get_cpuid (0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+		return 0;
+	}
+	__get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx >> 8) & 1;
+}
+
+static void tsc_calibrate () {
+
+	struct timespec pause = {0, MQ_CLOCK_CALIBRATION_NSEC};
+	int64_t m0 = 0, m1 = 0, r0 = 0;
+	uint64_t c0 = 0, c1 = 0;
+
+	r0 = clock_read (CLOCK_REALTIME);
+	m0 = clock_read (MQ_CLOCK_MONOTONIC_ID);
+	c0 = __rdtsc ();
+	nanosleep (&pause, 0);
+	m1 = clock_read (MQ_CLOCK_MONOTONIC_ID);
+	c1 = __rdtsc ();
+
+	mq_clock_nsec_per_tick = (double) (m1 - m0) / (double) (c1 - c0);
+	mq_clock_tsc0 = c0;
+	mq_clock_tsc0_nsec = r0;
+}
+#endif
+
+int mq_clock_init (const char* name) {
+
+	int i = 0;
+	int64_t t0 = 0;
+	int64_t t1 = 0;
+
+	for (i = 0; i < (int) (sizeof(mq_clock_names) / sizeof(mq_clock_names[0])); i++) {
+		if (strcmp (name, mq_clock_names[i]) == 0) break;
+	}
+	switch (i) {
+	case MQ_CLOCK_REALTIME:
+		mq_clock_anchor_nsec = 0;
+		break;
+	case MQ_CLOCK_MONOTONIC:
+		mq_clock_anchor_nsec = clock_read (CLOCK_REALTIME) - clock_read (MQ_CLOCK_MONOTONIC_ID);
+		break;
+	case MQ_CLOCK_TSC:
+#ifdef MQ_CLOCK_HAS_TSC
+		if (!tsc_invariant ()) {
+			mq_log_error ("TSC is not invariant on this cpu, use 'monotonic'");
+			return -1;
+		}
+		tsc_calibrate ();
+		break;
+#else
+		mq_log_error ("TSC clock is not supported on this platform");
+		return -1;
+#endif
+	default:
+		mq_log_error ("Unknown clock '%s' (realtime | monotonic | tsc)", name);
+		return -1;
+	}
+	mq_clock_source = (MqClockSource) i;
+
+	t0 = clock_read (MQ_CLOCK_MONOTONIC_ID);
+	for (i = 0; i < MQ_CLOCK_OVERHEAD_READS; i++) {
+		mq_clock_now ();
+	}
+	t1 = clock_read (MQ_CLOCK_MONOTONIC_ID);
+	mq_clock_overhead = (double) (t1 - t0) / MQ_CLOCK_OVERHEAD_READS;
+
+	mq_log_info ("Clock '%s', read overhead %.1f nsec", mq_clock_name (), mq_clock_overhead);
+	return 0;
+}
+
+int64_t mq_clock_now () {
+	switch (mq_clock_source) {
+#ifdef MQ_CLOCK_HAS_TSC
+	case MQ_CLOCK_TSC:
+		return mq_clock_tsc0_nsec + (int64_t) ((double) (int64_t) (__rdtsc () - mq_clock_tsc0) * mq_clock_nsec_per_tick);
+#endif
+	case MQ_CLOCK_MONOTONIC:
+		return clock_read (MQ_CLOCK_MONOTONIC_ID) + mq_clock_anchor_nsec;
+	default:
+		return clock_read (CLOCK_REALTIME);
+	}
+}
+
+int64_t mq_clock_from_realtime (int64_t realtime_nsec) {
+	if (mq_clock_source == MQ_CLOCK_REALTIME) {
+		return realtime_nsec;
+	}
+	return realtime_nsec + (mq_clock_now () - clock_read (CLOCK_REALTIME));
+}
+
+const char* mq_clock_name () {
+	return mq_clock_names[mq_clock_source];
+}
+
+double mq_clock_overhead_nsec () {
+	return mq_clock_overhead;
+}
+
+void mq_clock_dump () {
+
+	struct timespec res = {0,0};
+
+	printf ("Clock -------------------------------------------------\n");
+	if (mq_clock_source == MQ_CLOCK_TSC) {
+		printf ("%s, %.3f GHz, read overhead %.1f nsec\n",
+				mq_clock_name (), 1.0 / mq_clock_nsec_per_tick, mq_clock_overhead);
+	} else {
+		clock_getres (mq_clock_source == MQ_CLOCK_REALTIME ? CLOCK_REALTIME : MQ_CLOCK_MONOTONIC_ID, &res);
+		printf ("%s, resolution %ld nsec, read overhead %.1f nsec\n",
+				mq_clock_name (), (long) res.tv_nsec, mq_clock_overhead);
+	}
+}
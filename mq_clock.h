@@ -0,0 +1,68 @@
+/*
+ * mq_clock.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_CLOCK_H_
+#define MQ_CLOCK_H_
+
+#include <stdint.h>
+
+/**
+ * process wide timestamp clock; signed nsec since the epoch.
+ *
+ * the source is selected once, before any thread starts:
+ *   realtime   CLOCK_REALTIME
+ *   monotonic  CLOCK_MONOTONIC_RAW; not slewed by NTP
+ *   tsc        invariant time stamp counter, calibrated against CLOCK_MONOTONIC_RAW
+ *
+ * monotonic and tsc are anchored to CLOCK_REALTIME at init, so stamps of
+ * every source are comparable across hosts (see mq_clocksync) while only
+ * realtime follows the NTP corrections made during the run.
+ * until mq_clock_init is called the source is realtime.
+ */
+typedef enum MqClockSource {
+	MQ_CLOCK_REALTIME = 0,
+	MQ_CLOCK_MONOTONIC,
+	MQ_CLOCK_TSC
+} MqClockSource;
+
+#define MQ_CLOCK_DEFAULT_SOURCE "realtime"
+
+#define MQ_CLOCK_CALIBRATION_NSEC 100000000 // tsc calibration period, 100 msec
+
+/**
+ * selects the source by name. returns -1 if the name is unknown or the
+ * source is not usable on this host (e.g. tsc is not invariant)
+ */
+int mq_clock_init (const char* name);
+
+/**
+ * current time of the selected source in nsec
+ */
+int64_t mq_clock_now ();
+
+/**
+ * a CLOCK_REALTIME stamp taken a moment ago (e.g. by the kernel) in the
+ * selected source; the offset between the two is read now, so NTP
+ * corrections made since init do not show up in the difference
+ */
+int64_t mq_clock_from_realtime (int64_t realtime_nsec);
+
+/**
+ * name of the selected source
+ */
+const char* mq_clock_name ();
+
+/**
+ * measured cost of a single mq_clock_now, nsec
+ */
+double mq_clock_overhead_nsec ();
+
+/**
+ * prints the source, its resolution / frequency and read overhead
+ */
+void mq_clock_dump ();
+
+#endif /* MQ_CLOCK_H_ */
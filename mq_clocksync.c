@@ -0,0 +1,161 @@
+/*
+ * mq_clocksync.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mq_clocksync.h"
+#include "mq_log.h"
+
+void mq_clocksync_init (MqClockSync* cs, int interval_sec) {
+	memset (cs, 0, sizeof(MqClockSync));
+	cs->interval_usec = (int64_t) interval_sec * 1000000;
+}
+
+/* keeps the best sample of the burst and refits the offset / drift */
+static void end_burst (MqClockSync* cs, int64_t now_usec) {
+
+	double t = 0.0;
+	double n = 0.0;
+	double denom = 0.0;
+
+	cs->in_burst = 0;
+
+	if (cs->received == 0) {
+		mq_log_debug ("No answer to clock sync requests, retrying");
+		cs->next_burst_usec = now_usec + MQ_CLOCKSYNC_RETRY_USEC;
+		return;
+	}
+	if (cs->interval_usec > 0) {
+		cs->next_burst_usec = now_usec + cs->interval_usec;
+	} else {
+		cs->next_burst_usec = INT64_MAX;
+	}
+
+	if (cs->num_bursts == 0) {
+		cs->first_usec = cs->best_t4_usec;
+	}
+	t = (double) (cs->best_t4_usec - cs->first_usec);
+	cs->sum_t += t;
+	cs->sum_o += cs->best_offset_usec;
+	cs->sum_tt += t * t;
+	cs->sum_to += t * cs->best_offset_usec;
+	cs->num_bursts++;
+
+	n = cs->num_bursts;
+	denom = n * cs->sum_tt - cs->sum_t * cs->sum_t;
+	if (cs->num_bursts > 1 && denom > 0.0) {
+		cs->drift = (n * cs->sum_to - cs->sum_t * cs->sum_o) / denom;
+	} else {
+		cs->drift = 0.0;
+	}
+	// the fit evaluated at the latest sample
+	cs->offset_usec = (cs->sum_o - cs->drift * cs->sum_t) / n + cs->drift * t;
+	cs->ref_usec = cs->best_t4_usec;
+	cs->error_usec = cs->best_delay_usec / 2.0;
+	cs->valid = 1;
+
+	mq_log_info ("Clock offset %.1f +/- %.1f usec, drift %.3f ppm",
+			cs->offset_usec, cs->error_usec, cs->drift * 1e6);
+}
+
+int mq_clocksync_poll (MqClockSync* cs, int64_t now_usec, const char* reply_topic, char* buf, int len) {
+
+	if (!cs->in_burst) {
+		if (now_usec < cs->next_burst_usec) return 0;
+		cs->in_burst = 1;
+		cs->sent = 0;
+		cs->received = 0;
+		cs->sent_usec = 0;
+		cs->best_delay_usec = INT64_MAX;
+	}
+
+	if (cs->sent_usec && now_usec - cs->sent_usec < MQ_CLOCKSYNC_TIMEOUT_USEC) {
+		return 0; // wait for the answer
+	}
+	// nobody answers (yet); do not wait for the whole burst to time out
+	if (cs->sent == MQ_CLOCKSYNC_BURST || (cs->sent_usec && cs->received == 0)) {
+		end_burst (cs, now_usec);
+		return 0;
+	}
+
+	cs->seq++;
+	cs->sent++;
+	cs->sent_usec = now_usec;
+	snprintf (buf, len, "%d %lld %s", cs->seq, (long long) now_usec, reply_topic);
+	return 1;
+}
+
+int mq_clocksync_answer (MqClockSync* cs, const char* msg, int msg_len, int64_t t4_usec) {
+
+	char buf[MQ_CLOCKSYNC_MAX_MSG_LEN];
+	int seq = 0;
+	long long t1 = 0, t2 = 0, t3 = 0;
+	int64_t delay = 0;
+
+	if (msg_len <= 0 || msg_len >= MQ_CLOCKSYNC_MAX_MSG_LEN) return -1;
+	memcpy (buf, msg, msg_len);
+	buf[msg_len] = 0;
+
+	if (sscanf (buf, "%d %lld %lld %lld", &seq, &t1, &t2, &t3) != 4) {
+		mq_log_warning ("Malformed clock sync answer");
+		return -1;
+	}
+	if (!cs->in_burst || seq != cs->seq) {
+		return 0; // late answer to an abandoned request
+	}
+	cs->sent_usec = 0;
+	cs->received++;
+
+	delay = (t4_usec - t1) - (t3 - t2);
+	if (delay < cs->best_delay_usec) {
+		cs->best_delay_usec = delay;
+		cs->best_offset_usec = ((t2 - t1) + (t3 - t4_usec)) / 2.0;
+		cs->best_t4_usec = t4_usec;
+	}
+	return 0;
+}
+
+int mq_clocksync_serve (const char* msg, int msg_len, int64_t t2_usec,
+		char* reply_topic, int topic_len, char* buf, int len) {
+
+	char req[MQ_CLOCKSYNC_MAX_MSG_LEN];
+	char fmt[32];
+	int seq = 0;
+	long long t1 = 0;
+
+	if (msg_len <= 0 || msg_len >= MQ_CLOCKSYNC_MAX_MSG_LEN) return -1;
+	memcpy (req, msg, msg_len);
+	req[msg_len] = 0;
+
+	snprintf (fmt, sizeof(fmt), "%%d %%lld %%%ds", topic_len - 1);
+	if (sscanf (req, fmt, &seq, &t1, reply_topic) != 3) {
+		mq_log_warning ("Malformed clock sync request");
+		return -1;
+	}
+	snprintf (buf, len, "%d %lld %lld", seq, t1, (long long) t2_usec);
+	return strlen (buf);
+}
+
+int mq_clocksync_stamp (char* buf, int pos, int len, int64_t t3_usec) {
+	snprintf (buf + pos, len - pos, " %lld", (long long) t3_usec);
+	return strlen (buf);
+}
+
+int64_t mq_clocksync_offset (const MqClockSync* cs, int64_t now_usec) {
+	if (!cs->valid) return 0;
+	return (int64_t) (cs->offset_usec + cs->drift * (now_usec - cs->ref_usec));
+}
+
+void mq_clocksync_dump (const MqClockSync* cs) {
+	printf ("Clock sync --------------------------------------------\n");
+	if (!cs->valid) {
+		printf ("no estimate, delays are not corrected\n");
+		return;
+	}
+	printf ("offset %.1f +/- %.1f usec, drift %.3f ppm, %d bursts\n",
+			cs->offset_usec, cs->error_usec, cs->drift * 1e6, cs->num_bursts);
+}
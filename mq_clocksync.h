@@ -0,0 +1,96 @@
+/*
+ * mq_clocksync.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_CLOCKSYNC_H_
+#define MQ_CLOCKSYNC_H_
+
+#include <stdint.h>
+
+/**
+ * NTP style estimation of the offset (and drift) of the producer's clock
+ * w.r.t. the consumer's clock over a control topic.
+ *
+ * the consumer publishes "<seq> <t1> <reply-topic>" on '<control-topic>/req',
+ * t1 is its send time. the producer answers on <reply-topic> w/ "<seq> <t1> <t2> <t3>",
+ * t2 and t3 being its receive and send times. the consumer receives the answer at t4:
+ *
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2    producer clock - consumer clock
+ *   delay  = (t4 - t1) - (t3 - t2)          round trip through the broker
+ *
+ * the offset is within +/- delay/2 of the truth. requests are sent in bursts;
+ * the sample w/ the smallest delay of a burst is kept (NTP clock filter).
+ * the drift is the slope of a least squares fit over the kept samples.
+ * all times are usec.
+ */
+
+#define MQ_CLOCKSYNC_BURST 8               // requests per burst
+#define MQ_CLOCKSYNC_TIMEOUT_USEC 200000   // a request w/o answer is abandoned
+#define MQ_CLOCKSYNC_RETRY_USEC 100000     // burst w/o any answer is retried
+#define MQ_CLOCKSYNC_MAX_MSG_LEN 1200
+
+typedef struct MqClockSync {
+	int64_t interval_usec;  // between bursts, 0 for a single burst at start
+	int64_t next_burst_usec;
+	int in_burst;
+	int sent;               // requests sent in this burst
+	int received;           // answers received in this burst
+	int seq;
+	int64_t sent_usec;      // send time of the outstanding request, 0 if none
+
+	int64_t best_delay_usec;  // best sample of the burst
+	double best_offset_usec;
+	int64_t best_t4_usec;
+
+	// fit over the best samples of all bursts; times relative to the first one
+	int num_bursts;
+	int64_t first_usec;
+	double sum_t, sum_o, sum_tt, sum_to;
+
+	int valid;
+	double offset_usec;       // at ref_usec
+	double drift;             // usec per usec
+	int64_t ref_usec;
+	double error_usec;        // delay/2 of the last kept sample
+} MqClockSync;
+
+void mq_clocksync_init (MqClockSync* cs, int interval_sec);
+
+/**
+ * consumer side; returns 1 and fills buf w/ a request to be published on
+ * '<control-topic>/req' if one is due at now_usec, 0 otherwise
+ */
+int mq_clocksync_poll (MqClockSync* cs, int64_t now_usec, const char* reply_topic, char* buf, int len);
+
+/**
+ * consumer side; feeds an answer received at t4_usec. returns -1 if it is malformed
+ */
+int mq_clocksync_answer (MqClockSync* cs, const char* msg, int msg_len, int64_t t4_usec);
+
+/**
+ * producer side; parses a request received at t2_usec and fills buf w/ the answer
+ * but t3, to be published on reply_topic. returns the length of the answer so far,
+ * -1 if the request is malformed
+ */
+int mq_clocksync_serve (const char* msg, int msg_len, int64_t t2_usec,
+		char* reply_topic, int topic_len, char* buf, int len);
+
+/**
+ * producer side; completes the answer of mq_clocksync_serve (pos long) w/ t3_usec,
+ * taken right before it is published. returns the length of the answer
+ */
+int mq_clocksync_stamp (char* buf, int pos, int len, int64_t t3_usec);
+
+/**
+ * estimated producer clock - consumer clock at consumer time now_usec, 0 if no estimate yet
+ */
+int64_t mq_clocksync_offset (const MqClockSync* cs, int64_t now_usec);
+
+/**
+ * prints the estimate
+ */
+void mq_clocksync_dump (const MqClockSync* cs);
+
+#endif /* MQ_CLOCKSYNC_H_ */
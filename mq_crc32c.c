@@ -0,0 +1,134 @@
+/*
+ * mq_crc32c.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#include "mq_crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define MQ_CRC32C_X86 1
+  #include <nmmintrin.h>
+#endif
+
+#define MQ_CRC32C_POLY 0x82f63b78 // reversed Castagnoli polynomial
+
+static uint32_t mq_crc32c_table[8][256];
+
+static uint32_t (*mq_crc32c_fn) (uint32_t, const unsigned char*, size_t) = 0;
+
+static pthread_once_t mq_crc32c_once = PTHREAD_ONCE_INIT;
+
+
+/* slicing by 8; the crc is kept inverted */
+static uint32_t crc32c_sw (uint32_t crc, const unsigned char* p, size_t len) {
+
+	uint64_t w = 0;
+
+	while (len && ((uintptr_t) p & 7)) {
+		crc = mq_crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8) {
+		memcpy (&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		w = __builtin_bswap64 (w);
+#endif
+		w ^= crc;
+		crc = mq_crc32c_table[7][w & 0xff] ^
+			  mq_crc32c_table[6][(w >> 8) & 0xff] ^
+			  mq_crc32c_table[5][(w >> 16) & 0xff] ^
+			  mq_crc32c_table[4][(w >> 24) & 0xff] ^
+			  mq_crc32c_table[3][(w >> 32) & 0xff] ^
+			  mq_crc32c_table[2][(w >> 40) & 0xff] ^
+			  mq_crc32c_table[1][(w >> 48) & 0xff] ^
+			  mq_crc32c_table[0][w >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc = mq_crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#ifdef MQ_CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw (uint32_t crc, const unsigned char* p, size_t len) {
+
+	while (len && ((uintptr_t) p & 7)) {
+		crc = _mm_crc32_u8 (crc, *p++);
+		len--;
+	}
+#ifdef __x86_64__
+	{
+		uint64_t c = crc;
+		uint64_t w = 0;
+		while (len >= 8) {
+			memcpy (&w, p, 8);
+			c = _mm_crc32_u64 (c, w);
+			p += 8;
+			len -= 8;
+		}
+		crc = (uint32_t) c;
+	}
+#endif
+	while (len >= 4) {
+		uint32_t w = 0;
+		memcpy (&w, p, 4);
+		crc = _mm_crc32_u32 (crc, w);
+		p += 4;
+		len -= 4;
+	}
+	while (len--) {
+		crc = _mm_crc32_u8 (crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+static void crc32c_init () {
+
+	uint32_t crc = 0;
+	int i = 0;
+	int j = 0;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = (crc & 1) ? (crc >> 1) ^ MQ_CRC32C_POLY : crc >> 1;
+		}
+		mq_crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = mq_crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = mq_crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			mq_crc32c_table[j][i] = crc;
+		}
+	}
+
+	mq_crc32c_fn = crc32c_sw;
+#ifdef MQ_CRC32C_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse4.2")) {
+		mq_crc32c_fn = crc32c_hw;
+	}
+#endif
+}
+
+uint32_t mq_crc32c (uint32_t crc, const void* buf, size_t len) {
+	pthread_once (&mq_crc32c_once, crc32c_init);
+	return ~mq_crc32c_fn (~crc, (const unsigned char*) buf, len);
+}
+
+const char* mq_crc32c_impl () {
+	pthread_once (&mq_crc32c_once, crc32c_init);
+#ifdef MQ_CRC32C_X86
+	if (mq_crc32c_fn == crc32c_hw) return "sse4.2";
+#endif
+	return "slicing-by-8";
+}
@@ -0,0 +1,27 @@
+/*
+ * mq_crc32c.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_CRC32C_H_
+#define MQ_CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * CRC32C (Castagnoli) of len bytes of buf, continuing from crc; start w/ 0.
+ * crc of (a followed by b) == mq_crc32c (mq_crc32c (0, a, len_a), b, len_b).
+ *
+ * uses the SSE4.2 crc32 instruction when the cpu has it, slicing by 8
+ * tables otherwise.
+ */
+uint32_t mq_crc32c (uint32_t crc, const void* buf, size_t len);
+
+/**
+ * name of the implementation mq_crc32c uses on this cpu
+ */
+const char* mq_crc32c_impl ();
+
+#endif /* MQ_CRC32C_H_ */
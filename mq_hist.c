@@ -0,0 +1,188 @@
+/*
+ * mq_hist.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mq_hist.h"
+#include "mq_log.h"
+
+/* index of the most significant bit, v > 0 */
+static int msb (uint64_t v) {
+#ifdef __GNUC__
+	return 63 - __builtin_clzll (v);
+#else
+	int n = 0;
+	while (v >>= 1) n++;
+	return n;
+#endif
+}
+
+static size_t index_of (const MqHist* hist, int64_t value) {
+
+	int shift = 0;
+	size_t index = 0;
+
+	if (value < (1LL << hist->sub_bits)) {
+		return (size_t) value;
+	}
+	// value >> shift is in [2^(sub_bits-1), 2^sub_bits)
+	shift = msb (value) - (hist->sub_bits - 1);
+	index = ((size_t) 1 << hist->sub_bits) + (size_t) (shift - 1) * ((size_t) 1 << (hist->sub_bits - 1)) +
+			(size_t) ((value >> shift) - (1LL << (hist->sub_bits - 1)));
+
+	return index < hist->num_counts ? index : hist->num_counts - 1;
+}
+
+/* highest value that falls into the bucket */
+static int64_t value_of (const MqHist* hist, size_t index) {
+
+	size_t half = (size_t) 1 << (hist->sub_bits - 1);
+	int shift = 0;
+	int64_t sub = 0;
+
+	if (index < ((size_t) 1 << hist->sub_bits)) {
+		return (int64_t) index;
+	}
+	index -= (size_t) 1 << hist->sub_bits;
+	shift = (int) (index / half) + 1;
+	sub = (int64_t) (index % half + half);
+	return ((sub + 1) << shift) - 1;
+}
+
+/* lowest value that falls into the bucket */
+static int64_t low_of (const MqHist* hist, size_t index) {
+	return index ? value_of (hist, index - 1) + 1 : 0;
+}
+
+int mq_hist_init (MqHist* hist, int sub_bits, int max_bits) {
+
+	memset (hist, 0, sizeof(MqHist));
+
+	if (sub_bits < 2 || sub_bits > 16 || max_bits <= sub_bits || max_bits > 62) {
+		mq_log_error ("Bad histogram precision %d / %d bits", sub_bits, max_bits);
+		return -1;
+	}
+	hist->sub_bits = sub_bits;
+	hist->max_bits = max_bits;
+	// the bounds above keep this below 2^21
+	hist->num_counts = ((size_t) 1 << sub_bits) + (size_t) (max_bits - sub_bits) * ((size_t) 1 << (sub_bits - 1));
+
+	// the negative buckets follow the positive ones, so recording never allocates
+	hist->counts = (int64_t*) malloc (2 * hist->num_counts * sizeof(int64_t));
+	if (!hist->counts) {
+		mq_log_error ("Memory for histogram cannot be allocated!");
+		return -1;
+	}
+	hist->neg_counts = hist->counts + hist->num_counts;
+	mq_hist_reset (hist);
+	return 0;
+}
+
+void mq_hist_destroy (MqHist* hist) {
+	free (hist->counts);
+	hist->counts = 0;
+	hist->neg_counts = 0;
+}
+
+void mq_hist_reset (MqHist* hist) {
+	memset (hist->counts, 0, 2 * hist->num_counts * sizeof(int64_t));
+	hist->total = 0;
+	hist->min = INT64_MAX;
+	hist->max = INT64_MIN;
+	hist->sum = 0.0;
+}
+
+void mq_hist_record (MqHist* hist, int64_t value) {
+
+	if (value < 0) {
+		hist->neg_counts[index_of (hist, value == INT64_MIN ? INT64_MAX : -value)]++;
+	} else {
+		hist->counts[index_of (hist, value)]++;
+	}
+	hist->total++;
+	hist->sum += value;
+	if (value < hist->min) hist->min = value;
+	if (value > hist->max) hist->max = value;
+}
+
+void mq_hist_merge (MqHist* dst, const MqHist* src) {
+
+	size_t i = 0;
+
+	if (src->total == 0) return;
+
+	// the negative buckets too
+	for (i = 0; i < 2 * dst->num_counts; i++) {
+		dst->counts[i] += src->counts[i];
+	}
+	dst->total += src->total;
+	dst->sum += src->sum;
+	if (src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+int64_t mq_hist_percentile (const MqHist* hist, double p) {
+
+	int64_t rank = 0;
+	int64_t seen = 0;
+	int64_t value = 0;
+	size_t i = 0;
+
+	if (hist->total == 0) return 0;
+
+	rank = (int64_t) (p / 100.0 * hist->total + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > hist->total) rank = hist->total;
+
+	// negative values from the most negative up, then the non-negative ones
+	if (hist->min < 0) {
+		for (i = hist->num_counts; i-- > 0; ) {
+			seen += hist->neg_counts[i];
+			if (seen >= rank) break;
+		}
+	}
+	if (seen >= rank) {
+		value = -low_of (hist, i);
+	} else {
+		for (i = 0; i < hist->num_counts; i++) {
+			seen += hist->counts[i];
+			if (seen >= rank) break;
+		}
+		value = value_of (hist, i);
+	}
+	if (value > hist->max) value = hist->max;
+	if (value < hist->min) value = hist->min;
+	return value;
+}
+
+double mq_hist_mean (const MqHist* hist) {
+	return hist->total ? hist->sum / hist->total : 0.0;
+}
+
+void mq_hist_dump_header (const char* title) {
+	printf ("%-16s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", title,
+			"count", "min", "p50", "p90", "p99", "p99.9", "p99.99", "max", "avg");
+}
+
+void mq_hist_dump_row (const char* name, const MqHist* hist, double divisor) {
+
+	if (hist->total == 0) {
+		printf ("%-16s %10d\n", name, 0);
+		return;
+	}
+	printf ("%-16s %10lld %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+			(long long) hist->total,
+			hist->min / divisor,
+			mq_hist_percentile (hist, 50.0) / divisor,
+			mq_hist_percentile (hist, 90.0) / divisor,
+			mq_hist_percentile (hist, 99.0) / divisor,
+			mq_hist_percentile (hist, 99.9) / divisor,
+			mq_hist_percentile (hist, 99.99) / divisor,
+			hist->max / divisor,
+			mq_hist_mean (hist) / divisor);
+}
@@ -0,0 +1,76 @@
+/*
+ * mq_hist.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_HIST_H_
+#define MQ_HIST_H_
+
+#include <stdint.h>
+
+/**
+ * HDR style log-linear histogram of integer values.
+ *
+ * values below 2^sub_bits are counted exactly. above that every power of two
+ * range is split into 2^(sub_bits-1) linear sub buckets, so the relative error
+ * of a recorded value is below 1/2^(sub_bits-1) (sub_bits 7: < 1.6%).
+ * values above 2^max_bits-1 are counted in the last bucket; the exact min and
+ * max are kept aside. negative values (e.g. delays under clock skew, delay
+ * variation) are counted in mirrored buckets. memory is fixed at init,
+ * recording is O(1).
+ */
+typedef struct MqHist {
+	int sub_bits;
+	int max_bits;
+	size_t num_counts;   // of counts and of neg_counts
+	int64_t* counts;
+	int64_t* neg_counts; // counts of -value, in the allocation of counts
+	int64_t total;
+	int64_t min;
+	int64_t max;
+	double sum;
+} MqHist;
+
+#define MQ_HIST_DEFAULT_SUB_BITS 7
+#define MQ_HIST_DEFAULT_MAX_BITS 40 // 2^40 nsec ~ 18 minutes
+
+/**
+ * returns -1 on error
+ */
+int mq_hist_init (MqHist* hist, int sub_bits, int max_bits);
+
+void mq_hist_destroy (MqHist* hist);
+
+void mq_hist_reset (MqHist* hist);
+
+/**
+ * negative values are recorded as 0 if their buckets cannot be allocated
+ */
+void mq_hist_record (MqHist* hist, int64_t value);
+
+/**
+ * adds the counts of src to dst. both must have the same sub_bits and max_bits
+ */
+void mq_hist_merge (MqHist* dst, const MqHist* src);
+
+/**
+ * p-th (0-100) percentile; the highest value equivalent to the bucket the
+ * percentile falls in, capped by the recorded max
+ */
+int64_t mq_hist_percentile (const MqHist* hist, double p);
+
+double mq_hist_mean (const MqHist* hist);
+
+/**
+ * prints the header of a table of histogram rows
+ */
+void mq_hist_dump_header (const char* title);
+
+/**
+ * prints a table row: count, min, p50, p90, p99, p99.9, p99.99, max, mean.
+ * values are divided by divisor (e.g. 1000 to print nsec values as usec)
+ */
+void mq_hist_dump_row (const char* name, const MqHist* hist, double divisor);
+
+#endif /* MQ_HIST_H_ */
@@ -0,0 +1,62 @@
+/*
+ * mq_inflight.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mq_inflight.h"
+#include "mq_log.h"
+
+int mq_inflight_init (MqInflight* inflight) {
+
+	memset (inflight, 0, sizeof(MqInflight));
+
+	inflight->sent_nsec = (int64_t*) malloc (MQ_INFLIGHT_SLOTS * sizeof(int64_t));
+	if (!inflight->sent_nsec) {
+		mq_log_error ("Memory for in-flight table cannot be allocated!");
+		return -1;
+	}
+	memset (inflight->sent_nsec, 0, MQ_INFLIGHT_SLOTS * sizeof(int64_t));
+	if (mq_hist_init (&inflight->ack, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1) {
+		free (inflight->sent_nsec);
+		inflight->sent_nsec = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void mq_inflight_sent (MqInflight* inflight, uint16_t mid, int64_t now_nsec) {
+
+	if (inflight->sent_nsec[mid] == 0) {
+		inflight->count++;
+		if (inflight->count > inflight->peak) inflight->peak = inflight->count;
+	} else {
+		// mid wrapped around while the old message is still in flight
+		mq_log_warning ("Message id %d is reused while in flight", mid);
+	}
+	inflight->sent_nsec[mid] = now_nsec;
+}
+
+int mq_inflight_acked (MqInflight* inflight, uint16_t mid, int64_t now_nsec) {
+
+	if (inflight->sent_nsec[mid] == 0) {
+		inflight->unknown++;
+		return -1;
+	}
+
+	mq_hist_record (&inflight->ack, now_nsec - inflight->sent_nsec[mid]);
+	inflight->num_acks++;
+
+	inflight->sent_nsec[mid] = 0;
+	inflight->count--;
+	return 0;
+}
+
+void mq_inflight_destroy (MqInflight* inflight) {
+	free (inflight->sent_nsec);
+	mq_hist_destroy (&inflight->ack);
+	memset (inflight, 0, sizeof(MqInflight));
+}
@@ -0,0 +1,44 @@
+/*
+ * mq_inflight.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_INFLIGHT_H_
+#define MQ_INFLIGHT_H_
+
+#include <stdint.h>
+
+#include "mq_hist.h"
+
+#define MQ_INFLIGHT_SLOTS 65536 // one per mqtt message id
+
+/**
+ * QoS 1/2 in-flight message table of a publisher, keyed by the mqtt message id.
+ * records the publish time of every message and, when the PUBACK/PUBCOMP
+ * arrives, the handshake latency. needs no clock sync w/ the consumers.
+ */
+typedef struct MqInflight {
+	int64_t* sent_nsec;  // publish time (mq_clock) by mid, 0 if not in flight
+	int count;           // in flight now
+	int peak;            // maximum in flight
+	int64_t unknown;     // acks for mids that were not in flight
+	int num_acks;
+	MqHist ack;          // handshake latency, nsec
+} MqInflight;
+
+/**
+ * returns -1 on error
+ */
+int mq_inflight_init (MqInflight* inflight);
+
+void mq_inflight_sent (MqInflight* inflight, uint16_t mid, int64_t now_nsec);
+
+/**
+ * records the handshake latency of mid. returns -1 if mid was not in flight
+ */
+int mq_inflight_acked (MqInflight* inflight, uint16_t mid, int64_t now_nsec);
+
+void mq_inflight_destroy (MqInflight* inflight);
+
+#endif /* MQ_INFLIGHT_H_ */
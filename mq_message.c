@@ -5,80 +5,167 @@
  *      Author: tufanoruk
  */
 
-/**
- *
- *  ASSUMING ALL PARTIES HAS THE SAME ENDIANESS AND PADDING
- *
- */
-
-#include <sys/time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include "mq_message.h"
+#include "mq_clock.h"
+#include "mq_crc32c.h"
 #include "mq_log.h"
 
-static int mq_payload_size = 0;
-static byte* mq_msg = 0;
-static int mq_msg_id = 1; // start from 1
+int mq_message_init (MqMessageCtx* ctx, const MqPayloadDist* dist, uint32_t producer, int seed, int crc) {
 
-void mq_message_init (int payload_size) {
-	mq_payload_size = payload_size;
-	mq_msg = (byte*) malloc (mq_payload_size);
-	memset(mq_msg, 0, mq_payload_size);
-}
+	unsigned short xsubi[3] = {0x330e, (unsigned short) seed, (unsigned short) (seed >> 16)};
+	uint32_t* prefix_crcs = 0;
+	int i = 0;
 
-byte* mq_message_renew() {
+	memset (ctx, 0, sizeof(MqMessageCtx));
+	ctx->seq = 1; // start from 1
+	ctx->producer = producer;
 
-	struct timeval tv = {0,0};
-	byte* p = mq_msg;
+	if (dist->min < MQ_MESSAGE_HEADER_SIZE) {
+		mq_log_error ("Payload size must be at least %d", (int) MQ_MESSAGE_HEADER_SIZE);
+		return -1;
+	}
 
-	memcpy (p, &mq_msg_id, sizeof(int));
-	p += sizeof(int);
+	ctx->sizes = (int*) malloc (MQ_MESSAGE_SIZE_RING * sizeof(int));
+	if (!ctx->sizes) {
+		mq_log_error ("Memory for payload sizes cannot be allocated!");
+		return -1;
+	}
+	for (i = 0; i < MQ_MESSAGE_SIZE_RING; i++) {
+		ctx->sizes[i] = mq_payload_draw (dist, xsubi);
+	}
 
-	if (gettimeofday (&tv,0) == -1) {
-		mq_log_error ("Error getting time");
-		return 0; // error!
+	for (i = 0; i < MQ_MESSAGE_POOL_SLOTS; i++) {
+		ctx->pool[i] = (byte*) malloc (dist->max);
+		if (!ctx->pool[i]) {
+			mq_log_error ("Memory for payload pool cannot be allocated!");
+			return -1;
+		}
+		memset (ctx->pool[i], 0, MQ_MESSAGE_HEADER_SIZE);
+		memset (ctx->pool[i] + MQ_MESSAGE_HEADER_SIZE, 't', dist->max - MQ_MESSAGE_HEADER_SIZE);
 	}
 
-	memcpy (p, &tv,sizeof(struct timeval));
-	p += sizeof(struct timeval);
+	if (crc) {
+		// crcs of every load prefix in a single pass, then pick those of the drawn sizes
+		ctx->load_crcs = (uint32_t*) malloc (MQ_MESSAGE_SIZE_RING * sizeof(uint32_t));
+		prefix_crcs = (uint32_t*) malloc ((dist->max - MQ_MESSAGE_HEADER_SIZE + 1) * sizeof(uint32_t));
+		if (!ctx->load_crcs || !prefix_crcs) {
+			mq_log_error ("Memory for payload crcs cannot be allocated!");
+			free (prefix_crcs);
+			return -1;
+		}
+		prefix_crcs[0] = 0;
+		for (i = 0; i < dist->max - MQ_MESSAGE_HEADER_SIZE; i++) {
+			prefix_crcs[i + 1] = mq_crc32c (prefix_crcs[i], ctx->pool[0] + MQ_MESSAGE_HEADER_SIZE + i, 1);
+		}
+		for (i = 0; i < MQ_MESSAGE_SIZE_RING; i++) {
+			ctx->load_crcs[i] = prefix_crcs[ctx->sizes[i] - MQ_MESSAGE_HEADER_SIZE];
+		}
+		free (prefix_crcs);
+	}
+	return 0;
+}
+
+byte* mq_message_renew (MqMessageCtx* ctx, int phase, int64_t late_nsec, int* size) {
+
+	byte* msg = ctx->pool[ctx->seq % MQ_MESSAGE_POOL_SLOTS];
+	MqMessageHeader* h = (MqMessageHeader*) msg;
+	int64_t now = mq_clock_now ();
+
+	h->magic[0] = MQ_MESSAGE_MAGIC_0;
+	h->magic[1] = MQ_MESSAGE_MAGIC_1;
+	h->version = MQ_MESSAGE_VERSION;
+	h->flags = late_nsec > 0 ? MQ_MESSAGE_FLAG_LATE : 0;
+	h->phase = htobe16 ((uint16_t) phase);
+	h->length = htobe16 ((uint16_t) MQ_MESSAGE_HEADER_SIZE);
+	h->producer = htobe32 (ctx->producer);
+	h->crc = 0;
+	h->seq = htobe64 (ctx->seq);
+	h->txtime = (int64_t) htobe64 ((uint64_t) now);
+	h->intended_txtime = (int64_t) htobe64 ((uint64_t) (now - late_nsec));
+
+	if (ctx->load_crcs) {
+		h->flags |= MQ_MESSAGE_FLAG_CRC;
+		h->crc = htobe32 (mq_crc32c (ctx->load_crcs[ctx->seq % MQ_MESSAGE_SIZE_RING], h, MQ_MESSAGE_HEADER_SIZE));
+	}
 
-	memset (p, 't', mq_payload_size - (sizeof(int) + sizeof(struct timeval)));
+	*size = ctx->sizes[ctx->seq % MQ_MESSAGE_SIZE_RING];
 
-	mq_msg_id++;
-	return mq_msg;
+	ctx->seq++;
+	return msg;
 }
 
-void mq_message_destroy () {
-	if (mq_msg) {
-		free (mq_msg);
-		mq_msg = 0;
+void mq_message_destroy (MqMessageCtx* ctx) {
+	int i = 0;
+
+	for (i = 0; i < MQ_MESSAGE_POOL_SLOTS; i++) {
+		free (ctx->pool[i]);
+		ctx->pool[i] = 0;
 	}
+	free (ctx->sizes);
+	ctx->sizes = 0;
+	free (ctx->load_crcs);
+	ctx->load_crcs = 0;
 }
 
-int mq_message_id (byte* msg) {
-	int id = 0;
-	byte* p = (byte*)msg;
-	if (p) {
-		memcpy (&id, p, sizeof(int));
-	} else {
-		mq_log_error ("message had not been set!");
+const MqMessageHeader* mq_message_header (const void* payload, int len) {
+
+	const MqMessageHeader* h = (const MqMessageHeader*) payload;
+
+	if (!payload || len < (int) MQ_MESSAGE_HEADER_SIZE) {
+		return 0;
+	}
+	if (h->magic[0] != MQ_MESSAGE_MAGIC_0 || h->magic[1] != MQ_MESSAGE_MAGIC_1 ||
+		h->version != MQ_MESSAGE_VERSION ||
+		be16toh (h->length) < MQ_MESSAGE_HEADER_SIZE || be16toh (h->length) > len) {
+		return 0;
 	}
-	return id;
+	return h;
 }
 
-struct timeval mq_message_txtime (byte* msg) {
-	struct timeval tv = {0,0};
-	byte* p = (byte*)msg;
-	memcpy (&tv, p + sizeof(int), sizeof(struct timeval));
+int mq_message_check (MqMessageCheck* chk, const MqMessageHeader* h, int len) {
+
+	MqMessageHeader hdr;
+	uint32_t crc = 0;
+	int64_t t0 = 0;
 
-	return tv;
+	if (!(h->flags & MQ_MESSAGE_FLAG_CRC)) {
+		return 0;
+	}
+	t0 = mq_clock_now ();
+	memcpy (&hdr, h, MQ_MESSAGE_HEADER_SIZE);
+	hdr.crc = 0;
+	crc = mq_crc32c (0, (const byte*) h + MQ_MESSAGE_HEADER_SIZE, len - MQ_MESSAGE_HEADER_SIZE);
+	crc = mq_crc32c (crc, &hdr, MQ_MESSAGE_HEADER_SIZE);
+	chk->nsec += mq_clock_now () - t0;
+	chk->bytes += len;
+	chk->checked++;
+
+	if (crc != be32toh (h->crc)) {
+		chk->corrupt++;
+		return -1;
+	}
+	return 0;
+}
+
+void mq_message_check_dump (const MqMessageCheck* chk) {
+	printf ("Integrity ---------------------------------------------\n");
+	if (chk->checked == 0) {
+		printf ("no crc stamped messages\n");
+		return;
+	}
+	printf ("%" PRId64 " checked, %" PRId64 " corrupt, %" PRId64 " bytes, crc32c (%s) %.3f nsec/byte\n",
+			chk->checked, chk->corrupt, chk->bytes, mq_crc32c_impl (),
+			chk->bytes ? (double) chk->nsec / chk->bytes : 0.0);
 }
 
 /* FILE* f must be opened w/ fopen */
-void mq_message_dump (FILE* f, byte* msg) {
-	int id = mq_message_id(msg);
-	struct timeval tv = mq_message_txtime(msg);
-	fprintf (f,"[%d] %lu.%d\n", id, tv.tv_sec, tv.tv_usec);
+void mq_message_dump (FILE* f, const MqMessageHeader* h) {
+	int64_t tx = mq_message_txtime (h);
+	fprintf (f, "[%" PRIu32 ":%" PRIu64 "] %" PRId64 ".%09" PRId64 " phase %d flags 0x%02x\n",
+			mq_message_producer (h), mq_message_seq (h), tx / 1000000000, tx % 1000000000,
+			mq_message_phase (h), mq_message_flags (h));
 }
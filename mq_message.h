@@ -9,43 +9,170 @@
 #define MQ_MESSAGE_H_
 
 #include <stdio.h>
+#include <stdint.h>
+
+#ifdef MOSQ_DARWIN
+  #include <libkern/OSByteOrder.h>
+  #define htobe16(x) OSSwapHostToBigInt16(x)
+  #define htobe32(x) OSSwapHostToBigInt32(x)
+  #define htobe64(x) OSSwapHostToBigInt64(x)
+  #define be16toh(x) OSSwapBigToHostInt16(x)
+  #define be32toh(x) OSSwapBigToHostInt32(x)
+  #define be64toh(x) OSSwapBigToHostInt64(x)
+#else
+  #include <endian.h>
+#endif
+
+#include "mq_payload.h"
 
 /**
- * struct message {int id; timeval txtime; byte* load};
+ * wire header of a message; packed, every field is big endian (network order)
+ * so that producers and consumers need not share endianness or padding.
  *
- * first sizeof(int) bytes holds the message.id
- * sizeof(timeval) bytes after the first sizeof(int) bytes of the message holds mesage.txtime
- * load is payload_size - (sizeof(int) + sizeof(timeval))
+ *  offset size
+ *   0     2   magic, 'M' 'Q'
+ *   2     1   version, MQ_MESSAGE_VERSION
+ *   3     1   flags, MQ_MESSAGE_FLAG_*
+ *   4     2   load profile phase
+ *   6     2   header length; later versions may only append fields
+ *   8     4   producer id
+ *  12     4   CRC32C of the load followed by the header w/ this field 0,
+ *             if flags has MQ_MESSAGE_FLAG_CRC. 0 otherwise
+ *  16     8   sequence number, starts from 1 per producer
+ *  24     8   txtime, nsec since the epoch
+ *  32     8   intended txtime, nsec since the epoch. the time the message was
+ *             scheduled to be sent, earlier than txtime when the producer falls behind
  *
+ * the load follows the header and is payload_size - MQ_MESSAGE_HEADER_SIZE bytes
  */
+typedef struct __attribute__((packed)) MqMessageHeader {
+	uint8_t magic[2];
+	uint8_t version;
+	uint8_t flags;
+	uint16_t phase;
+	uint16_t length;
+	uint32_t producer;
+	uint32_t crc;
+	uint64_t seq;
+	int64_t txtime;
+	int64_t intended_txtime;
+} MqMessageHeader;
+
+#define MQ_MESSAGE_HEADER_SIZE sizeof(MqMessageHeader)
+
+#define MQ_MESSAGE_MAGIC_0 'M'
+#define MQ_MESSAGE_MAGIC_1 'Q'
+#define MQ_MESSAGE_VERSION 2 // 1 was the raw int/timeval header, which had no version
+
+#define MQ_MESSAGE_FLAG_LATE 0x01 // sent later than scheduled
+#define MQ_MESSAGE_FLAG_CRC  0x02 // crc is stamped
+
+#define MQ_MESSAGE_MAX_PHASES 64 // load profile phases a consumer keeps apart
+
+#define MQ_MESSAGE_POOL_SLOTS 8    // pre-filled payload buffers per context
+#define MQ_MESSAGE_SIZE_RING 4096  // pre-drawn payload sizes per context
 
 typedef char byte;
 
 /**
- * creates a reusable message
+ * message stream of a single producer. every publisher (thread) owns one;
+ * the pool is MQ_MESSAGE_POOL_SLOTS buffers of the maximum payload size,
+ * filled once in init, and a ring of MQ_MESSAGE_SIZE_RING payload sizes drawn
+ * from the size distribution in init. renew only writes the header.
+ *
+ * loads never change after init, so their crcs are computed once per
+ * size ring entry; stamping a crc costs a crc over the header only.
  */
-void mq_message_init (int payload_size);
+typedef struct MqMessageCtx {
+	byte* pool[MQ_MESSAGE_POOL_SLOTS];
+	int* sizes;
+	uint32_t* load_crcs; // 0 if crcs are not stamped
+	uint64_t seq;      // of the next message
+	uint32_t producer;
+} MqMessageCtx;
 
 /**
- * updates id and txtime fields of the message and returns underlying message buffer
+ * integrity check counters of a consumer
  */
-byte* mq_message_renew ();
+typedef struct MqMessageCheck {
+	int64_t checked;  // messages w/ a crc
+	int64_t corrupt;
+	int64_t bytes;    // checked bytes
+	int64_t nsec;     // spent checking
+} MqMessageCheck;
 
 /**
- * cleans message buffer created in mq_message_init
+ * creates the payload pool of the context; payload sizes are drawn
+ * from dist. seed makes the sizes of different contexts independent.
+ * w/ crc every message is stamped w/ a CRC32C.
+ * returns -1 on error
  */
-void mq_message_destroy ();
+int mq_message_init (MqMessageCtx* ctx, const MqPayloadDist* dist, uint32_t producer, int seed, int crc);
 
-int mq_message_id (byte* msg);
+/**
+ * takes the next buffer of the pool, stamps a new header and returns it.
+ * size is set to the payload size to publish.
+ * late_nsec is how late the message is w.r.t. its schedule;
+ * intended txtime is txtime - late_nsec
+ */
+byte* mq_message_renew (MqMessageCtx* ctx, int phase, int64_t late_nsec, int* size);
 
-struct timeval mq_message_txtime (byte* msg);
+/**
+ * cleans the payload pool created in mq_message_init
+ */
+void mq_message_destroy (MqMessageCtx* ctx);
+
+/**
+ * header of a received payload, read in place; 0 if the payload is too short,
+ * is not a message or has an unknown version
+ */
+const MqMessageHeader* mq_message_header (const void* payload, int len);
+
+/**
+ * verifies the crc of a received message of len bytes, if it has one, and
+ * counts it in chk. returns -1 if the message is corrupt
+ */
+int mq_message_check (MqMessageCheck* chk, const MqMessageHeader* h, int len);
+
+/**
+ * prints the integrity check counters and the cost of checking
+ */
+void mq_message_check_dump (const MqMessageCheck* chk);
+
+static inline uint64_t mq_message_seq (const MqMessageHeader* h) {
+	return be64toh (h->seq);
+}
+
+static inline uint32_t mq_message_producer (const MqMessageHeader* h) {
+	return be32toh (h->producer);
+}
+
+static inline int mq_message_flags (const MqMessageHeader* h) {
+	return h->flags;
+}
+
+static inline int64_t mq_message_txtime (const MqMessageHeader* h) {
+	return (int64_t) be64toh (h->txtime);
+}
+
+static inline int64_t mq_message_intended_txtime (const MqMessageHeader* h) {
+	return (int64_t) be64toh (h->intended_txtime);
+}
+
+/**
+ * load profile phase of the message, clamped to [0, MQ_MESSAGE_MAX_PHASES)
+ */
+static inline int mq_message_phase (const MqMessageHeader* h) {
+	int phase = be16toh (h->phase);
+	return phase < MQ_MESSAGE_MAX_PHASES ? phase : MQ_MESSAGE_MAX_PHASES - 1;
+}
 
 /**
- * helper function that dumps id and txtime to the given file
+ * helper function that dumps the header to the given file
  *
  * FILE*f must be opened w/ fopen
  * */
-void mq_message_dump (FILE* f, byte* msg);
+void mq_message_dump (FILE* f, const MqMessageHeader* h);
 
 
 #endif /* MQ_MESSAGE_H_ */
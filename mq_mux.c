@@ -0,0 +1,322 @@
+/*
+ * mq_mux.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <sys/resource.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef MOSQ_LINUX
+  #include <sys/epoll.h>
+#else
+  #include <poll.h>
+#endif
+
+#include "mq_mux.h"
+#include "mq_clock.h"
+#include "mq_util.h"
+#include "mq_log.h"
+
+int mq_mux_init (MqMux* mux, int num_shards) {
+
+	int i = 0;
+
+	memset (mux, 0, sizeof(MqMux));
+	if (num_shards <= 0 || num_shards > MQ_MUX_MAX_SHARDS) {
+		mq_log_error ("Number of multiplexer threads must be 1-%d", MQ_MUX_MAX_SHARDS);
+		return -1;
+	}
+	mux->shards = (MqMuxShard*) calloc (num_shards, sizeof(MqMuxShard));
+	if (!mux->shards) {
+		mq_log_error ("Memory for multiplexer cannot be allocated!");
+		return -1;
+	}
+	mux->num_shards = num_shards;
+	for (i = 0; i < num_shards; i++) {
+		mux->shards[i].mux = mux;
+		mux->shards[i].epfd = -1;
+	}
+	for (i = 0; i < num_shards; i++) {
+#ifdef MOSQ_LINUX
+		mux->shards[i].epfd = epoll_create1 (0);
+		if (mux->shards[i].epfd == -1) {
+			mq_log_error ("epoll cannot be created: %s", strerror (errno));
+			return -1;
+		}
+#endif
+	}
+	return 0;
+}
+
+int mq_mux_add (MqMux* mux, int shard, struct mosquitto* mosq) {
+
+	MqMuxShard* sh = mux->shards + (shard % mux->num_shards);
+	MqMuxClient* c = 0;
+	void* p = 0;
+#ifdef MOSQ_LINUX
+	struct epoll_event ev;
+#endif
+
+	if (sh->running) {
+		mq_log_error ("Clients cannot be added to a running multiplexer");
+		return -1;
+	}
+	if (sh->num_clients == sh->capacity) {
+		sh->capacity = sh->capacity ? 2 * sh->capacity : 64;
+		p = realloc (sh->clients, sh->capacity * sizeof(MqMuxClient));
+		if (!p) {
+			mq_log_error ("Memory for multiplexer cannot be allocated!");
+			return -1;
+		}
+		sh->clients = (MqMuxClient*) p;
+	}
+	c = sh->clients + sh->num_clients;
+	memset (c, 0, sizeof(MqMuxClient));
+	c->mosq = mosq;
+	c->fd = mosquitto_socket (mosq);
+	if (c->fd < 0) {
+		mq_log_error ("Client is not connected");
+		return -1;
+	}
+	if (mux->kernel_tstamps && mq_tstamp_enable_rx (c->fd) == -1) {
+		return -1;
+	}
+#ifdef MOSQ_LINUX
+	// the client is known by its index, so the array can grow
+	ev.events = EPOLLIN;
+	ev.data.u64 = (uint64_t) sh->num_clients;
+	if (epoll_ctl (sh->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+		mq_log_error ("Client socket cannot be added to epoll: %s", strerror (errno));
+		return -1;
+	}
+#endif
+	sh->num_clients++;
+	return 0;
+}
+
+static void client_close (MqMuxShard* sh, MqMuxClient* c, int result) {
+#ifdef MOSQ_LINUX
+	epoll_ctl (sh->epfd, EPOLL_CTL_DEL, c->fd, 0);
+#endif
+	c->closed = 1;
+	sh->num_closed++;
+	mq_util_print_error (result);
+}
+
+/* waits for write readiness only while there is something to write; a client
+ * epoll cannot follow any more is closed, it would stall w/ its data unsent */
+static void client_update_interest (MqMuxShard* sh, MqMuxClient* c, int index) {
+
+	int writing = mosquitto_want_write (c->mosq) ? 1 : 0;
+#ifdef MOSQ_LINUX
+	struct epoll_event ev;
+
+	if (writing == c->writing) return;
+	ev.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+	ev.data.u64 = (uint64_t) index;
+	if (epoll_ctl (sh->epfd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+		mq_log_error ("Client socket cannot be modified in epoll: %s", strerror (errno));
+		client_close (sh, c, MOSQ_ERR_CONN_LOST);
+		return;
+	}
+#endif
+	c->writing = writing;
+}
+
+static void client_serve (MqMuxShard* sh, int index, int readable, int writable) {
+
+	MqMuxClient* c = sh->clients + index;
+	int result = MOSQ_ERR_SUCCESS;
+
+	if (c->closed) return;
+	if (readable) {
+		sh->kernel_rxtime = sh->mux->kernel_tstamps ? mq_tstamp_rx (c->fd) : 0;
+		result = mosquitto_loop_read (c->mosq);
+	}
+	if (result == MOSQ_ERR_SUCCESS && writable) {
+		result = mosquitto_loop_write (c->mosq);
+	}
+	if (result != MOSQ_ERR_SUCCESS) {
+		client_close (sh, c, result);
+		return;
+	}
+	client_update_interest (sh, c, index);
+}
+
+static void shard_misc (MqMuxShard* sh) {
+
+	MqMuxClient* c = 0;
+	int result = MOSQ_ERR_SUCCESS;
+	int i = 0;
+
+	for (i = 0; i < sh->num_clients; i++) {
+		c = sh->clients + i;
+		if (c->closed) continue;
+		result = mosquitto_loop_misc (c->mosq);
+		if (result != MOSQ_ERR_SUCCESS) {
+			client_close (sh, c, result);
+			continue;
+		}
+		client_update_interest (sh, c, i); // e.g. a PINGREQ is queued
+	}
+}
+
+#ifdef MOSQ_LINUX
+static void* shard_run (void* arg) {
+
+	MqMuxShard* sh = (MqMuxShard*) arg;
+	struct epoll_event events[MQ_MUX_MAX_EVENTS];
+	int64_t next_misc = mq_clock_now () + MQ_MUX_MISC_MSEC * 1000000LL;
+	int64_t now = 0;
+	int n = 0;
+	int i = 0;
+
+	while (!__atomic_load_n (&sh->mux->stop, __ATOMIC_ACQUIRE)) {
+		n = epoll_wait (sh->epfd, events, MQ_MUX_MAX_EVENTS, MQ_MUX_WAIT_MSEC);
+		for (i = 0; i < n; i++) {
+			client_serve (sh, (int) events[i].data.u64,
+					events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP), events[i].events & EPOLLOUT);
+		}
+		if (n > 0) sh->events += n;
+
+		now = mq_clock_now ();
+		if (now >= next_misc) {
+			shard_misc (sh);
+			next_misc = now + MQ_MUX_MISC_MSEC * 1000000LL;
+		}
+	}
+	return 0;
+}
+#else
+static void* shard_run (void* arg) {
+
+	MqMuxShard* sh = (MqMuxShard*) arg;
+	struct pollfd* fds = (struct pollfd*) malloc (sh->num_clients * sizeof(struct pollfd));
+	int* indices = (int*) malloc (sh->num_clients * sizeof(int));
+	int64_t next_misc = mq_clock_now () + MQ_MUX_MISC_MSEC * 1000000LL;
+	int64_t now = 0;
+	int nfds = 0;
+	int i = 0;
+
+	if (!fds || !indices) {
+		mq_log_error ("Memory for multiplexer cannot be allocated!");
+		free (fds);
+		free (indices);
+		return 0;
+	}
+	while (!__atomic_load_n (&sh->mux->stop, __ATOMIC_ACQUIRE)) {
+		nfds = 0;
+		for (i = 0; i < sh->num_clients; i++) {
+			if (sh->clients[i].closed) continue;
+			fds[nfds].fd = sh->clients[i].fd;
+			fds[nfds].events = POLLIN | (sh->clients[i].writing ? POLLOUT : 0);
+			fds[nfds].revents = 0;
+			indices[nfds++] = i;
+		}
+		if (poll (fds, nfds, MQ_MUX_WAIT_MSEC) > 0) {
+			for (i = 0; i < nfds; i++) {
+				if (!fds[i].revents) continue;
+				client_serve (sh, indices[i], fds[i].revents & (POLLIN | POLLERR | POLLHUP),
+						fds[i].revents & POLLOUT);
+				sh->events++;
+			}
+		}
+
+		now = mq_clock_now ();
+		if (now >= next_misc) {
+			shard_misc (sh);
+			next_misc = now + MQ_MUX_MISC_MSEC * 1000000LL;
+		}
+	}
+	free (fds);
+	free (indices);
+	return 0;
+}
+#endif
+
+int mq_mux_start (MqMux* mux) {
+
+	MqMuxShard* sh = 0;
+	int i = 0;
+	int j = 0;
+
+	for (i = 0; i < mux->num_shards; i++) {
+		sh = mux->shards + i;
+		if (sh->num_clients == 0) continue;
+		for (j = 0; j < sh->num_clients; j++) {
+			client_update_interest (sh, sh->clients + j, j); // e.g. SUBSCRIBE is queued
+		}
+		if (pthread_create (&sh->thread, 0, shard_run, sh) != 0) {
+			mq_log_error ("Multiplexer thread %d cannot be created!", i);
+			return -1;
+		}
+		sh->running = 1;
+	}
+	return 0;
+}
+
+void mq_mux_stop (MqMux* mux) {
+
+	int i = 0;
+
+	__atomic_store_n (&mux->stop, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < mux->num_shards; i++) {
+		if (!mux->shards[i].running) continue;
+		pthread_join (mux->shards[i].thread, 0);
+		mux->shards[i].running = 0;
+	}
+}
+
+void mq_mux_destroy (MqMux* mux) {
+
+	int i = 0;
+
+	if (!mux->shards) return;
+	for (i = 0; i < mux->num_shards; i++) {
+		if (mux->shards[i].epfd != -1) close (mux->shards[i].epfd);
+		free (mux->shards[i].clients);
+	}
+	free (mux->shards);
+	mux->shards = 0;
+}
+
+int mq_mux_reserve_fds (int count) {
+
+	struct rlimit rl;
+
+	if (getrlimit (RLIMIT_NOFILE, &rl) == -1) {
+		mq_log_error ("Open files limit cannot be read: %s", strerror (errno));
+		return -1;
+	}
+	if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t) count) {
+		if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < (rlim_t) count) {
+			mq_log_error ("%d open files are needed, the hard limit is %ld", count, (long) rl.rlim_max);
+			return -1;
+		}
+		rl.rlim_cur = count;
+		if (setrlimit (RLIMIT_NOFILE, &rl) == -1) {
+			mq_log_error ("Open files limit cannot be raised: %s", strerror (errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void mq_mux_dump (const MqMux* mux) {
+
+	const MqMuxShard* sh = 0;
+	int i = 0;
+
+	printf ("Multiplexer -------------------------------------------\n");
+	for (i = 0; i < mux->num_shards; i++) {
+		sh = mux->shards + i;
+		printf ("[%2d] %d clients, %d disconnected, %lld events\n", i, sh->num_clients, sh->num_closed,
+				(long long) sh->events);
+	}
+}
@@ -0,0 +1,98 @@
+/*
+ * mq_mux.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_MUX_H_
+#define MQ_MUX_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <mosquitto.h>
+
+#include "mq_tstamp.h"
+
+#define MQ_MUX_MAX_SHARDS 64
+#define MQ_MUX_WAIT_MSEC 10    // readiness wait, bounds the stop latency
+#define MQ_MUX_MISC_MSEC 500   // keepalive housekeeping of every client
+#define MQ_MUX_MAX_EVENTS 256
+
+/**
+ * a client driven by the multiplexer
+ */
+typedef struct MqMuxClient {
+	struct mosquitto* mosq;
+	int fd;
+	int writing;   // waiting for write readiness too
+	int closed;    // connection lost, no longer served
+} MqMuxClient;
+
+struct MqMux;
+
+/**
+ * the clients served by a single thread
+ */
+typedef struct MqMuxShard {
+	struct MqMux* mux;
+	pthread_t thread;
+	int running;
+	int epfd;              // linux
+	MqMuxClient* clients;
+	int num_clients;
+	int capacity;
+	int num_closed;
+	int64_t events;        // readiness events served
+	int64_t kernel_rxtime; // of the data being read, for the callbacks; 0 w/o kernel_tstamps
+} MqMuxShard;
+
+/**
+ * drives many mosquitto clients w/ a few threads instead of a thread (or a
+ * process) per client. clients are split into shards; the thread of a shard
+ * waits for the readiness of its clients' sockets (epoll on linux, poll
+ * elsewhere), runs mosquitto_loop_read / _write on the ready ones only and
+ * mosquitto_loop_misc of every client each MQ_MUX_MISC_MSEC.
+ *
+ * mosquitto has no locking: once a client is added it must only be used from
+ * its callbacks, which run on the thread of its shard.
+ */
+typedef struct MqMux {
+	MqMuxShard* shards;
+	int num_shards;
+	int stop;
+	int kernel_tstamps;    // set before adding clients: stamp reads w/ mq_tstamp_rx
+} MqMux;
+
+/**
+ * returns -1 on error
+ */
+int mq_mux_init (MqMux* mux, int num_shards);
+
+/**
+ * adds a connected client to the shard. clients can only be added before
+ * mq_mux_start. returns -1 on error
+ */
+int mq_mux_add (MqMux* mux, int shard, struct mosquitto* mosq);
+
+/**
+ * starts a thread per shard. returns -1 on error
+ */
+int mq_mux_start (MqMux* mux);
+
+/**
+ * stops and joins the shard threads; the clients are left as they are
+ */
+void mq_mux_stop (MqMux* mux);
+
+void mq_mux_destroy (MqMux* mux);
+
+/**
+ * raises the soft limit of open files to count if it is lower. returns -1
+ * if the hard limit is lower
+ */
+int mq_mux_reserve_fds (int count);
+
+void mq_mux_dump (const MqMux* mux);
+
+#endif /* MQ_MUX_H_ */
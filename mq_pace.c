@@ -0,0 +1,100 @@
+/*
+ * mq_pace.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
+#include "mq_pace.h"
+#include "mq_log.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+void mq_pace_init (MqPacer* pacer, double freq, long spin_usec) {
+
+	memset (pacer, 0, sizeof(MqPacer));
+
+	if (freq > 0.0) {
+		pacer->period_nsec = (int64_t) (NSEC_PER_SEC / freq);
+		if (pacer->period_nsec <= 0) {
+			mq_log_warning ("Publish frequency %f Hz is too high, running unpaced", freq);
+			pacer->period_nsec = 0;
+		}
+	}
+	if (spin_usec > 0) {
+		pacer->spin_nsec = (int64_t) spin_usec * 1000;
+	}
+}
+
+int64_t mq_pace_now_nsec () {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void mq_pace_start (MqPacer* pacer) {
+	pacer->start_nsec = mq_pace_now_nsec ();
+	pacer->deadline_nsec = pacer->start_nsec;
+}
+
+void mq_pace_set_period (MqPacer* pacer, int64_t period_nsec) {
+	pacer->period_nsec = period_nsec;
+}
+
+int64_t mq_pace_elapsed_nsec (const MqPacer* pacer) {
+	return pacer->deadline_nsec - pacer->start_nsec;
+}
+
+/* sleeps until the given CLOCK_MONOTONIC time */
+static void mq_pace_sleep_until (int64_t when_nsec) {
+
+	struct timespec ts;
+
+#ifdef MOSQ_DARWIN
+	// no clock_nanosleep; relative sleep is the best we can do
+	int64_t dt = when_nsec - mq_pace_now_nsec ();
+	if (dt <= 0) return;
+	ts.tv_sec = dt / NSEC_PER_SEC;
+	ts.tv_nsec = dt % NSEC_PER_SEC;
+	while (nanosleep (&ts, &ts) == -1 && errno == EINTR);
+#else
+	ts.tv_sec = when_nsec / NSEC_PER_SEC;
+	ts.tv_nsec = when_nsec % NSEC_PER_SEC;
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR);
+#endif
+}
+
+int64_t mq_pace_wait (MqPacer* pacer) {
+
+	int64_t now = 0;
+	int64_t slip = 0;
+
+	pacer->count++;
+
+	if (pacer->period_nsec == 0) {
+		return 0; // unpaced
+	}
+
+	now = mq_pace_now_nsec ();
+	if (now < pacer->deadline_nsec - pacer->spin_nsec) {
+		mq_pace_sleep_until (pacer->deadline_nsec - pacer->spin_nsec);
+		now = mq_pace_now_nsec ();
+	}
+	while (now < pacer->deadline_nsec) {
+		now = mq_pace_now_nsec ();
+	}
+
+	slip = now - pacer->deadline_nsec;
+	if (slip > 0) {
+		pacer->late_count++;
+		pacer->slip_nsec += slip;
+		if (slip > pacer->max_slip_nsec) pacer->max_slip_nsec = slip;
+	}
+
+	pacer->deadline_nsec += pacer->period_nsec;
+
+	return slip;
+}
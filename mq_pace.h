@@ -0,0 +1,66 @@
+/*
+ * mq_pace.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_PACE_H_
+#define MQ_PACE_H_
+
+#include <stdint.h>
+
+/**
+ * send pacing on absolute CLOCK_MONOTONIC deadlines.
+ *
+ * every deadline is computed from the start of the schedule, never from the
+ * time the previous wait returned, so the schedule does not drift. late sends
+ * are not re-scheduled; their lateness is accumulated as schedule slip.
+ *
+ * waits are done by sleeping until the deadline (TIMER_ABSTIME). if spin_nsec
+ * is set, sleeping stops spin_nsec before the deadline and the rest is spent
+ * spinning on the clock, which is needed for kHz-MHz rates.
+ */
+typedef struct MqPacer {
+	int64_t period_nsec;    // 0 means unpaced (as fast as possible)
+	int64_t spin_nsec;      // busy wait this much before each deadline
+	int64_t start_nsec;     // start of the schedule, CLOCK_MONOTONIC
+	int64_t deadline_nsec;  // next deadline, CLOCK_MONOTONIC
+	int64_t count;          // number of waits
+	int64_t late_count;     // number of waits that found the deadline passed
+	int64_t slip_nsec;      // cumulative lateness
+	int64_t max_slip_nsec;  // maximum lateness
+} MqPacer;
+
+/**
+ * freq is in Hz, may be fractional. freq <= 0 means unpaced.
+ */
+void mq_pace_init (MqPacer* pacer, double freq, long spin_usec);
+
+/**
+ * current CLOCK_MONOTONIC time in nsec
+ */
+int64_t mq_pace_now_nsec ();
+
+/**
+ * starts the schedule; the first deadline is now
+ */
+void mq_pace_start (MqPacer* pacer);
+
+/**
+ * sets the interval between the current deadline and the next one;
+ * for time varying load profiles
+ */
+void mq_pace_set_period (MqPacer* pacer, int64_t period_nsec);
+
+/**
+ * schedule time of the current deadline, i.e. nsec since start
+ */
+int64_t mq_pace_elapsed_nsec (const MqPacer* pacer);
+
+/**
+ * waits until the current deadline and moves to the next one.
+ * returns the lateness of this wait in nsec (0 if on time)
+ */
+int64_t mq_pace_wait (MqPacer* pacer);
+
+#endif /* MQ_PACE_H_ */
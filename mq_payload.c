@@ -0,0 +1,125 @@
+/*
+ * mq_payload.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mq_payload.h"
+#include "mq_log.h"
+
+#define MAX_LINE_LEN 256
+
+static int parse_histogram (MqPayloadDist* dist, const char* file_name) {
+
+	FILE* f = 0;
+	char line[MAX_LINE_LEN];
+	int capacity = 0;
+	int size = 0;
+	double weight = 0.0;
+	double total = 0.0;
+	void* p = 0;
+	void* q = 0;
+	int i = 0;
+
+	f = fopen (file_name, "r");
+	if (!f) {
+		mq_log_error ("Can't open payload size histogram '%s'", file_name);
+		return -1;
+	}
+
+	while (fgets (line, MAX_LINE_LEN, f)) {
+		if (line[0] == '#' || sscanf (line, "%d %lf", &size, &weight) != 2) continue;
+
+		if (size <= 0 || weight < 0.0) {
+			mq_log_error ("Bad histogram line '%s'", line);
+			fclose (f);
+			return -1;
+		}
+		if (dist->count == capacity) {
+			capacity = capacity ? 2 * capacity : 16;
+			p = realloc (dist->sizes, capacity * sizeof(int));
+			q = realloc (dist->cumulative, capacity * sizeof(double));
+			if (p) dist->sizes = (int*) p;
+			if (q) dist->cumulative = (double*) q;
+			if (!p || !q) {
+				mq_log_error ("Memory for payload size histogram cannot be allocated!");
+				fclose (f);
+				return -1;
+			}
+		}
+		total += weight;
+		dist->sizes[dist->count] = size;
+		dist->cumulative[dist->count] = total;
+		dist->count++;
+
+		if (dist->count == 1 || size < dist->min) dist->min = size;
+		if (dist->count == 1 || size > dist->max) dist->max = size;
+	}
+	fclose (f);
+
+	if (dist->count == 0 || total <= 0.0) {
+		mq_log_error ("Payload size histogram '%s' is empty", file_name);
+		return -1;
+	}
+	for (i = 0; i < dist->count; i++) {
+		dist->cumulative[i] /= total;
+	}
+	return 0;
+}
+
+int mq_payload_parse (MqPayloadDist* dist, const char* spec) {
+
+	memset (dist, 0, sizeof(MqPayloadDist));
+
+	if (spec[0] == '@') {
+		dist->type = MQ_PAYLOAD_HISTOGRAM;
+		return parse_histogram (dist, spec + 1);
+	}
+	if (sscanf (spec, "%d-%d", &dist->min, &dist->max) == 2) {
+		dist->type = MQ_PAYLOAD_UNIFORM;
+	} else {
+		dist->type = MQ_PAYLOAD_FIXED;
+		dist->min = dist->max = atoi (spec);
+	}
+	if (dist->min <= 0 || dist->max < dist->min) {
+		mq_log_error ("Bad payload size '%s'", spec);
+		return -1;
+	}
+	return 0;
+}
+
+int mq_payload_draw (const MqPayloadDist* dist, unsigned short xsubi[3]) {
+
+	double u = 0.0;
+	int lo = 0;
+	int hi = 0;
+	int mid = 0;
+
+	switch (dist->type) {
+	case MQ_PAYLOAD_UNIFORM:
+		return dist->min + (int) (erand48 (xsubi) * (dist->max - dist->min + 1));
+	case MQ_PAYLOAD_HISTOGRAM:
+		// first bin whose cumulative weight exceeds u
+		u = erand48 (xsubi);
+		hi = dist->count - 1;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (dist->cumulative[mid] > u) hi = mid;
+			else lo = mid + 1;
+		}
+		return dist->sizes[lo];
+	default:
+		return dist->min;
+	}
+}
+
+void mq_payload_destroy (MqPayloadDist* dist) {
+	free (dist->sizes);
+	free (dist->cumulative);
+	dist->sizes = 0;
+	dist->cumulative = 0;
+}
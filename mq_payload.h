@@ -0,0 +1,46 @@
+/*
+ * mq_payload.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_PAYLOAD_H_
+#define MQ_PAYLOAD_H_
+
+/**
+ * payload size distributions
+ *
+ * <size>            : every payload is <size> bytes
+ * <min>-<max>       : uniformly distributed in [min, max]
+ * @<file>           : empirical histogram, one "<size> <weight>" pair per line,
+ *                     lines starting w/ '#' are comments
+ */
+
+enum MQ_PAYLOAD_DIST_TYPE {
+	MQ_PAYLOAD_FIXED = 0,
+	MQ_PAYLOAD_UNIFORM,
+	MQ_PAYLOAD_HISTOGRAM
+};
+
+typedef struct MqPayloadDist {
+	int type;
+	int min;
+	int max;
+	int count;          // histogram bins
+	int* sizes;         // histogram bin sizes
+	double* cumulative; // histogram cumulative weights, normalized to 1
+} MqPayloadDist;
+
+/**
+ * returns -1 on error
+ */
+int mq_payload_parse (MqPayloadDist* dist, const char* spec);
+
+/**
+ * draws a payload size
+ */
+int mq_payload_draw (const MqPayloadDist* dist, unsigned short xsubi[3]);
+
+void mq_payload_destroy (MqPayloadDist* dist);
+
+#endif /* MQ_PAYLOAD_H_ */
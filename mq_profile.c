@@ -0,0 +1,168 @@
+/*
+ * mq_profile.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mq_profile.h"
+#include "mq_log.h"
+
+#define NSEC_PER_SEC 1000000000.0
+
+#define MQ_PROFILE_DEFAULT_RAMP_PHASES 10
+
+static const char* mq_profile_names[] = {"const", "ramp", "step", "burst", "poisson"};
+
+static int parse_steps (MqProfile* profile, char* list) {
+
+	char* save = 0;
+	char* tok = 0;
+
+	profile->num_phases = 0;
+	for (tok = strtok_r (list, ",", &save); tok; tok = strtok_r (0, ",", &save)) {
+		if (profile->num_phases == MQ_PROFILE_MAX_STEPS) {
+			mq_log_error ("At most %d steps are supported!", MQ_PROFILE_MAX_STEPS);
+			return -1;
+		}
+		profile->steps[profile->num_phases++] = atof (tok);
+	}
+	return profile->num_phases > 0 ? 0 : -1;
+}
+
+int mq_profile_parse (MqProfile* profile, const char* spec, double freq, int seed) {
+
+	char buf[1024];
+	char* fields[7] = {0};
+	char* save = 0;
+	int n = 0;
+	int i = 0;
+
+	memset (profile, 0, sizeof(MqProfile));
+	profile->type = MQ_PROFILE_CONST;
+	profile->rate = freq;
+	profile->num_phases = 1;
+	profile->xsubi[0] = 0x330e;
+	profile->xsubi[1] = (unsigned short) seed;
+	profile->xsubi[2] = (unsigned short) (seed >> 16);
+
+	if (!spec || !*spec) return 0;
+
+	strncpy (buf, spec, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+	for (fields[n] = strtok_r (buf, ":", &save); fields[n] && n < 6; fields[n] = strtok_r (0, ":", &save)) {
+		n++;
+	}
+
+	if (n == 0 || n == 6) {
+		goto bad;
+	} else if (strcmp (fields[0], "const") == 0 && n == 1) {
+		return 0;
+	} else if (strcmp (fields[0], "ramp") == 0 && (n == 4 || n == 5)) {
+		profile->type = MQ_PROFILE_RAMP;
+		profile->rate = atof (fields[1]);
+		profile->to_rate = atof (fields[2]);
+		profile->secs = atof (fields[3]);
+		profile->num_phases = n == 5 ? atoi (fields[4]) : MQ_PROFILE_DEFAULT_RAMP_PHASES;
+		if (profile->num_phases <= 0 || profile->num_phases > MQ_PROFILE_MAX_STEPS) {
+			mq_log_error ("Ramp phases must be 1-%d", MQ_PROFILE_MAX_STEPS);
+			return -1;
+		}
+		if (profile->rate <= 0 || profile->to_rate <= 0 || profile->secs <= 0) goto bad;
+	} else if (strcmp (fields[0], "step") == 0 && n == 3) {
+		profile->type = MQ_PROFILE_STEP;
+		profile->secs = atof (fields[2]);
+		if (parse_steps (profile, fields[1]) == -1 || profile->secs <= 0) goto bad;
+		for (i = 0; i < profile->num_phases; i++) {
+			if (profile->steps[i] <= 0) goto bad;
+		}
+	} else if (strcmp (fields[0], "burst") == 0 && n == 5) {
+		profile->type = MQ_PROFILE_BURST;
+		profile->rate = atof (fields[1]);
+		profile->to_rate = atof (fields[2]);
+		profile->secs = atof (fields[3]);
+		profile->burst_secs = atof (fields[4]);
+		profile->num_phases = 2;
+		if (profile->rate <= 0 || profile->to_rate <= 0 ||
+			profile->secs <= 0 || profile->burst_secs <= 0 || profile->burst_secs > profile->secs) goto bad;
+	} else if (strcmp (fields[0], "poisson") == 0 && n == 2) {
+		profile->type = MQ_PROFILE_POISSON;
+		profile->rate = atof (fields[1]);
+		if (profile->rate <= 0) goto bad;
+	} else {
+		goto bad;
+	}
+	return 0;
+
+	bad:
+	mq_log_error ("Bad load profile '%s'", spec);
+	return -1;
+}
+
+static int64_t interval_of (double rate) {
+	int64_t interval = (int64_t) (NSEC_PER_SEC / rate);
+	return interval > 0 ? interval : 1;
+}
+
+/**
+ * the next message is sent at the boundary at the latest, so that a slow
+ * rate does not step over the start of the next phase (or burst)
+ */
+static int64_t clip_at (int64_t interval, int64_t elapsed_nsec, int64_t boundary_nsec) {
+	if (elapsed_nsec + interval > boundary_nsec) {
+		interval = boundary_nsec - elapsed_nsec;
+	}
+	return interval > 0 ? interval : 1;
+}
+
+int mq_profile_next (MqProfile* profile, int64_t elapsed_nsec, int64_t* interval_nsec) {
+
+	double t = elapsed_nsec / NSEC_PER_SEC;
+	int64_t secs_nsec = (int64_t) (profile->secs * NSEC_PER_SEC);
+	int64_t burst_nsec = (int64_t) (profile->burst_secs * NSEC_PER_SEC);
+	int64_t boundary = 0;
+	int64_t pos = 0;
+	int phase = 0;
+
+	switch (profile->type) {
+	case MQ_PROFILE_RAMP:
+		if (elapsed_nsec >= secs_nsec) {
+			*interval_nsec = interval_of (profile->to_rate);
+			return profile->num_phases - 1;
+		}
+		phase = (int) (elapsed_nsec * profile->num_phases / secs_nsec);
+		// the first nsec of the next phase
+		boundary = ((phase + 1) * secs_nsec + profile->num_phases - 1) / profile->num_phases;
+		*interval_nsec = clip_at (interval_of (profile->rate + (profile->to_rate - profile->rate) * t / profile->secs),
+				elapsed_nsec, boundary);
+		return phase;
+	case MQ_PROFILE_STEP:
+		phase = (int) (elapsed_nsec / secs_nsec);
+		if (phase >= profile->num_phases - 1) {
+			*interval_nsec = interval_of (profile->steps[profile->num_phases - 1]);
+			return profile->num_phases - 1;
+		}
+		*interval_nsec = clip_at (interval_of (profile->steps[phase]), elapsed_nsec, (phase + 1) * secs_nsec);
+		return phase;
+	case MQ_PROFILE_BURST:
+		pos = elapsed_nsec % secs_nsec;
+		phase = pos < burst_nsec ? 1 : 0;
+		boundary = elapsed_nsec - pos + (phase ? burst_nsec : secs_nsec);
+		*interval_nsec = clip_at (interval_of (phase ? profile->to_rate : profile->rate), elapsed_nsec, boundary);
+		return phase;
+	case MQ_PROFILE_POISSON:
+		// 1 - U is in (0, 1], so the log is finite
+		*interval_nsec = interval_of (profile->rate / -log (1.0 - erand48 (profile->xsubi)));
+		return 0;
+	default:
+		*interval_nsec = profile->rate > 0 ? interval_of (profile->rate) : 0;
+		return 0;
+	}
+}
+
+const char* mq_profile_name (const MqProfile* profile) {
+	return mq_profile_names[profile->type];
+}
@@ -0,0 +1,71 @@
+/*
+ * mq_profile.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_PROFILE_H_
+#define MQ_PROFILE_H_
+
+#include <stdint.h>
+
+/**
+ * time varying load profiles. a profile gives the interval to the next
+ * message and the phase the current message belongs to, for a given
+ * schedule time (time since the start of the schedule).
+ *
+ * const                               : -f rate, phase 0
+ * ramp:<from>:<to>:<secs>[:<phases>]  : linear ramp from <from> Hz to <to> Hz in
+ *                                       <secs>, split into <phases> (10) phases.
+ *                                       stays at <to> Hz in the last phase.
+ * step:<hz>,<hz>,...:<secs>           : plateaus of <secs> each, phase n is plateau n.
+ *                                       stays at the last plateau.
+ * burst:<base>:<peak>:<period>:<len>  : <base> Hz, <peak> Hz for the first <len>
+ *                                       seconds of every <period> seconds.
+ *                                       phase 0 is base, phase 1 is burst.
+ * poisson:<mean>                      : exponential inter-arrival w/ <mean> Hz, phase 0
+ */
+
+#define MQ_PROFILE_MAX_STEPS 64 // same as MQ_MESSAGE_MAX_PHASES
+
+enum MQ_PROFILE_TYPE {
+	MQ_PROFILE_CONST = 0,
+	MQ_PROFILE_RAMP,
+	MQ_PROFILE_STEP,
+	MQ_PROFILE_BURST,
+	MQ_PROFILE_POISSON
+};
+
+typedef struct MqProfile {
+	int type;
+	double rate;       // const rate, ramp start, burst base, poisson mean (Hz)
+	double to_rate;    // ramp end, burst peak (Hz)
+	double secs;       // ramp length, step length, burst period
+	double burst_secs; // burst length
+	int num_phases;    // ramp phases, number of steps
+	double steps[MQ_PROFILE_MAX_STEPS];
+	unsigned short xsubi[3]; // poisson random state, one per publisher
+} MqProfile;
+
+/**
+ * parses the profile spec. freq is the -f rate used by the const profile.
+ * seed makes the poisson arrivals of different publishers independent.
+ * returns -1 on error
+ */
+int mq_profile_parse (MqProfile* profile, const char* spec, double freq, int seed);
+
+/**
+ * sets the interval (nsec) between the message scheduled at elapsed_nsec and
+ * the next one, and returns the phase of the message scheduled at elapsed_nsec.
+ * interval 0 means unpaced (const profile w/ 0 Hz). the interval is cut at the
+ * next phase (step, ramp phase, burst start or end), so that the message
+ * following a slow phase is sent right at its end
+ */
+int mq_profile_next (MqProfile* profile, int64_t elapsed_nsec, int64_t* interval_nsec);
+
+/**
+ * name of the profile type, for reports
+ */
+const char* mq_profile_name (const MqProfile* profile);
+
+#endif /* MQ_PROFILE_H_ */
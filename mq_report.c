@@ -0,0 +1,106 @@
+/*
+ * mq_report.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mq_report.h"
+
+#define MQ_REPORT_MAX_LINE_LEN 1024
+
+int mq_report_init (MqReport* r, const char* name, double interval_sec, MqReportFormat format,
+		const char* latency_name, const char* jitter_name, int sub_bits) {
+
+	memset (r, 0, sizeof(MqReport));
+	r->name = name;
+	r->latency_name = latency_name;
+	r->jitter_name = jitter_name;
+	r->format = format;
+	r->interval_nsec = (int64_t) (interval_sec * 1000000000.0);
+
+	if (mq_hist_init (&r->latency, sub_bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&r->jitter, sub_bits, MQ_HIST_DEFAULT_MAX_BITS) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+void mq_report_destroy (MqReport* r) {
+	mq_hist_destroy (&r->latency);
+	mq_hist_destroy (&r->jitter);
+}
+
+void mq_report_header (MqReportFormat format, const char* latency_name, const char* jitter_name) {
+	if (format != MQ_REPORT_CSV) return;
+	printf ("name,time,elapsed,msgs,msgs_s,bytes_s,lost,"
+			"%s_p50,%s_p90,%s_p99,%s_max,%s_p50,%s_p90,%s_p99,%s_max\n",
+			latency_name, latency_name, latency_name, latency_name,
+			jitter_name, jitter_name, jitter_name, jitter_name);
+	fflush (stdout);
+}
+
+void mq_report_start (MqReport* r, int64_t now) {
+	r->start = now;
+	r->window_start = now;
+	r->next = now + r->interval_nsec;
+}
+
+/* p50, p90, p99, max in usec; 0 if the interval has no samples */
+static void hist_quantiles (const MqHist* hist, double* q) {
+	if (hist->total == 0) {
+		q[0] = q[1] = q[2] = q[3] = 0.0;
+		return;
+	}
+	q[0] = mq_hist_percentile (hist, 50.0) / 1000.0;
+	q[1] = mq_hist_percentile (hist, 90.0) / 1000.0;
+	q[2] = mq_hist_percentile (hist, 99.0) / 1000.0;
+	q[3] = hist->max / 1000.0;
+}
+
+void mq_report_emit (MqReport* r, int64_t now, int64_t lost_total) {
+
+	char line[MQ_REPORT_MAX_LINE_LEN];
+	double window = (double) (now - r->window_start) / 1000000000.0;
+	double msgs_s = window > 0 ? r->messages / window : 0.0;
+	double bytes_s = window > 0 ? r->bytes / window : 0.0;
+	double lat[4];
+	double jit[4];
+
+	hist_quantiles (&r->latency, lat);
+	hist_quantiles (&r->jitter, jit);
+
+	if (r->format == MQ_REPORT_JSON) {
+		snprintf (line, sizeof(line), "{\"name\":\"%s\",\"time\":%.3f,\"elapsed\":%.3f,"
+				"\"msgs\":%" PRId64 ",\"msgs_s\":%.1f,\"bytes_s\":%.1f,\"lost\":%" PRId64 ","
+				"\"%s\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f},"
+				"\"%s\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+				r->name, now / 1000000000.0, (now - r->start) / 1000000000.0,
+				r->messages, msgs_s, bytes_s, lost_total - r->lost_total,
+				r->latency_name, lat[0], lat[1], lat[2], lat[3],
+				r->jitter_name, jit[0], jit[1], jit[2], jit[3]);
+	} else {
+		snprintf (line, sizeof(line), "%s,%.3f,%.3f,%" PRId64 ",%.1f,%.1f,%" PRId64 ","
+				"%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+				r->name, now / 1000000000.0, (now - r->start) / 1000000000.0,
+				r->messages, msgs_s, bytes_s, lost_total - r->lost_total,
+				lat[0], lat[1], lat[2], lat[3], jit[0], jit[1], jit[2], jit[3]);
+	}
+	// a single write, so lines of different threads do not interleave
+	fputs (line, stdout);
+	fflush (stdout);
+
+	r->messages = 0;
+	r->bytes = 0;
+	r->lost_total = lost_total;
+	mq_hist_reset (&r->latency);
+	mq_hist_reset (&r->jitter);
+	r->window_start = now;
+	r->next += r->interval_nsec;
+	if (r->next <= now) {
+		r->next = now + r->interval_nsec; // skip the intervals missed during a stall
+	}
+}
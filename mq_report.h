@@ -0,0 +1,77 @@
+/*
+ * mq_report.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_REPORT_H_
+#define MQ_REPORT_H_
+
+#include <stdint.h>
+
+#include "mq_hist.h"
+
+typedef enum MqReportFormat {
+	MQ_REPORT_CSV = 0,
+	MQ_REPORT_JSON
+} MqReportFormat;
+
+/**
+ * interval report; message and byte counts and a latency and a jitter
+ * histogram of the current interval, printed as a single CSV or JSON line
+ * on stdout and reset at the end of every interval. cumulative statistics
+ * are kept elsewhere, as before.
+ *
+ * a report is owned by a single thread; lines of reports on different
+ * threads do not interleave.
+ */
+typedef struct MqReport {
+	const char* name;          // source of the line, e.g. the topic
+	const char* latency_name;
+	const char* jitter_name;
+	MqReportFormat format;
+	int64_t interval_nsec;     // 0: no interval reports
+	int64_t start;
+	int64_t window_start;
+	int64_t next;              // end of the current interval
+	int64_t messages;
+	int64_t bytes;
+	int64_t lost_total;        // at the end of the previous interval
+	MqHist latency;            // nsec
+	MqHist jitter;             // nsec
+} MqReport;
+
+/**
+ * interval_sec 0 disables the report. returns -1 on error
+ */
+int mq_report_init (MqReport* r, const char* name, double interval_sec, MqReportFormat format,
+		const char* latency_name, const char* jitter_name, int sub_bits);
+
+void mq_report_destroy (MqReport* r);
+
+/**
+ * prints the CSV header line, once per process before the reports start
+ */
+void mq_report_header (MqReportFormat format, const char* latency_name, const char* jitter_name);
+
+/**
+ * starts the first interval at now (nsec)
+ */
+void mq_report_start (MqReport* r, int64_t now);
+
+static inline void mq_report_message (MqReport* r, int bytes) {
+	r->messages++;
+	r->bytes += bytes;
+}
+
+static inline int mq_report_due (const MqReport* r, int64_t now) {
+	return r->interval_nsec > 0 && now >= r->next;
+}
+
+/**
+ * prints the line of the interval ending at now and starts the next one.
+ * lost_total is the cumulative loss, the line carries its increase
+ */
+void mq_report_emit (MqReport* r, int64_t now, int64_t lost_total);
+
+#endif /* MQ_REPORT_H_ */
@@ -0,0 +1,69 @@
+/*
+ * mq_ring.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mq_ring.h"
+#include "mq_log.h"
+
+int mq_ring_init (MqRing* ring, int capacity, size_t elem_size) {
+
+	uint64_t size = 1;
+
+	memset (ring, 0, sizeof(MqRing));
+	if (capacity <= 0 || elem_size == 0) {
+		mq_log_error ("Invalid ring size %d x %d", capacity, (int) elem_size);
+		return -1;
+	}
+	while (size < (uint64_t) capacity) size <<= 1;
+
+	ring->slots = (unsigned char*) malloc (size * elem_size);
+	if (!ring->slots) {
+		mq_log_error ("Memory for ring cannot be allocated!");
+		return -1;
+	}
+	ring->mask = size - 1;
+	ring->elem_size = elem_size;
+	return 0;
+}
+
+void mq_ring_destroy (MqRing* ring) {
+	free (ring->slots);
+	ring->slots = 0;
+}
+
+int mq_ring_push (MqRing* ring, const void* elem) {
+
+	uint64_t head = ring->head; // only this thread writes it
+
+	if (head - ring->cached_tail > ring->mask) {
+		ring->cached_tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+		if (head - ring->cached_tail > ring->mask) {
+			return -1;
+		}
+	}
+	memcpy (ring->slots + (head & ring->mask) * ring->elem_size, elem, ring->elem_size);
+	// the record must be visible before the new head
+	__atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int mq_ring_pop (MqRing* ring, void* elem) {
+
+	uint64_t tail = ring->tail; // only this thread writes it
+
+	if (tail == ring->cached_head) {
+		ring->cached_head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+		if (tail == ring->cached_head) {
+			return -1;
+		}
+	}
+	memcpy (elem, ring->slots + (tail & ring->mask) * ring->elem_size, ring->elem_size);
+	// the slot may be reused once the new tail is visible
+	__atomic_store_n (&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * mq_ring.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_RING_H_
+#define MQ_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MQ_RING_CACHE_LINE 64
+
+/**
+ * lock-free single producer / single consumer ring of fixed size records.
+ *
+ * exactly one thread pushes and exactly one thread pops. the producer owns
+ * head, the consumer owns tail; each side keeps a cached copy of the other's
+ * index on its own cache line, so the shared indices are only read when the
+ * ring looks full (or empty). push and pop never block and never allocate.
+ */
+typedef struct MqRing {
+	uint64_t head __attribute__((aligned(MQ_RING_CACHE_LINE))); // next slot to write
+	uint64_t cached_tail;
+	uint64_t tail __attribute__((aligned(MQ_RING_CACHE_LINE)));  // next slot to read
+	uint64_t cached_head;
+	uint64_t mask __attribute__((aligned(MQ_RING_CACHE_LINE)));  // capacity - 1
+	size_t elem_size;
+	unsigned char* slots;
+} MqRing;
+
+/**
+ * capacity is rounded up to a power of two. returns -1 on error
+ */
+int mq_ring_init (MqRing* ring, int capacity, size_t elem_size);
+
+void mq_ring_destroy (MqRing* ring);
+
+/**
+ * copies elem into the ring. returns -1 if the ring is full
+ */
+int mq_ring_push (MqRing* ring, const void* elem);
+
+/**
+ * copies the oldest record to elem. returns -1 if the ring is empty
+ */
+int mq_ring_pop (MqRing* ring, void* elem);
+
+#endif /* MQ_RING_H_ */
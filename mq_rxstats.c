@@ -0,0 +1,158 @@
+/*
+ * mq_rxstats.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mq_rxstats.h"
+
+int mq_rxstats_init (MqRxStats* st, int bits, const char* name, double report_secs, MqReportFormat format) {
+
+	int phase = 0;
+
+	memset (st, 0, sizeof(MqRxStats));
+	if (mq_hist_init (&st->delay, bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&st->intended_delay, bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&st->rx_interval, bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&st->tx_interval, bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&st->rx_jitter, bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&st->tx_jitter, bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&st->kernel_delay, bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&st->rx_stack, bits, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_stream_table_init (&st->streams) == -1 ||
+		mq_report_init (&st->report, name, report_secs, format, "delay", "jitter", bits) == -1) {
+		return -1;
+	}
+	for (phase = 0; phase < MQ_MESSAGE_MAX_PHASES; phase++) {
+		mq_util_summary_init (&st->delay_phase[phase]);
+		mq_util_summary_init (&st->rx_jitter_phase[phase]);
+		mq_util_summary_init (&st->tx_jitter_phase[phase]);
+	}
+	st->num_phases = 1;
+	return 0;
+}
+
+void mq_rxstats_destroy (MqRxStats* st) {
+	mq_hist_destroy (&st->delay);
+	mq_hist_destroy (&st->intended_delay);
+	mq_hist_destroy (&st->rx_interval);
+	mq_hist_destroy (&st->tx_interval);
+	mq_hist_destroy (&st->rx_jitter);
+	mq_hist_destroy (&st->tx_jitter);
+	mq_hist_destroy (&st->kernel_delay);
+	mq_hist_destroy (&st->rx_stack);
+	mq_stream_table_destroy (&st->streams);
+	mq_report_destroy (&st->report);
+}
+
+void mq_rxstats_add (MqRxStats* st, const char* topic, const MqCaptureRecord* rec) {
+
+	int64_t now = rec->rxtime;
+	int64_t txtime = rec->txtime;
+	int64_t delay = rec->rxtime_tx - txtime;
+	int64_t rx_dt = 0;
+	int64_t tx_dt = 0;
+	int phase = rec->phase < MQ_MESSAGE_MAX_PHASES ? rec->phase : MQ_MESSAGE_MAX_PHASES - 1;
+	MqStream* stream = mq_stream_table_get (&st->streams, rec->producer, rec->subscriber, topic);
+	MqStreamArrival arrival = MQ_STREAM_IN_ORDER;
+	int64_t previous_transit = 0;
+	int64_t pairs = 0;
+
+	if (stream) {
+		previous_transit = stream->last_transit;
+		pairs = stream->interarrival.count;
+		arrival = mq_stream_add (stream, rec->seq, delay, now);
+		if (stream->interarrival.count > pairs) {
+			mq_hist_record (&st->report.jitter, delay > previous_transit ?
+					delay - previous_transit : previous_transit - delay);
+		}
+	}
+	if (arrival == MQ_STREAM_DUPLICATE) {
+		return;
+	}
+	mq_report_message (&st->report, rec->len);
+	mq_hist_record (&st->report.latency, delay);
+	mq_hist_record (&st->delay, delay);
+	mq_hist_record (&st->intended_delay, rec->rxtime_tx - rec->intended_txtime);
+	if (rec->kernel_rxtime) {
+		// in the producer's clock, as the delay
+		mq_hist_record (&st->kernel_delay, rec->kernel_rxtime + (rec->rxtime_tx - now) - txtime);
+		mq_hist_record (&st->rx_stack, now - rec->kernel_rxtime);
+	}
+	mq_util_summary_add (&st->delay_phase[phase], delay / 1000);
+	if (phase >= st->num_phases) st->num_phases = phase + 1;
+
+	st->count++;
+	if (!stream || arrival == MQ_STREAM_REORDERED || arrival == MQ_STREAM_LATE || rec->subscriber != st->subscriber) {
+		return; // does not move the stream forward
+	}
+	if (arrival == MQ_STREAM_GAP) {
+		stream->interval_count = 0; // restart the pairs after the missing ones
+	}
+	rx_dt = now - stream->previous_rxtime;
+	tx_dt = txtime - stream->previous_txtime;
+
+	/* determine jitter */
+	if (stream->interval_count > 0) {
+		/**
+		 * Take the difference of two packet tx/rx timestamps.
+		 * Since packet production rate is constant during a test session,
+		 * the difference of two consecutive packet timestamps gives us a relative delay,
+		 * including packet production rate.
+		 * Later we will use these relative delays to calculate the delay variations
+		 * by simply calculating their difference.
+		 * If everything were perfect, then (relative) delay variation (jitter) would be 0.
+		 */
+		mq_hist_record (&st->rx_interval, rx_dt);
+		mq_hist_record (&st->tx_interval, tx_dt);
+		if (stream->interval_count > 1) {
+			mq_hist_record (&st->rx_jitter, stream->previous_rx_dt - rx_dt);
+			mq_hist_record (&st->tx_jitter, stream->previous_tx_dt - tx_dt);
+			mq_util_summary_add (&st->rx_jitter_phase[phase], (stream->previous_rx_dt - rx_dt) / 1000);
+			mq_util_summary_add (&st->tx_jitter_phase[phase], (stream->previous_tx_dt - tx_dt) / 1000);
+		}
+		stream->previous_rx_dt = rx_dt;
+		stream->previous_tx_dt = tx_dt;
+	}
+	stream->previous_rxtime = now;
+	stream->previous_txtime = txtime;
+	stream->interval_count++;
+}
+
+void mq_rxstats_dump (const MqRxStats* st) {
+
+	int phase = 0;
+
+	printf ("%lld messages ----------------------------------------\n", (long long) st->count);
+	mq_hist_dump_header ("usec");
+	mq_hist_dump_row ("delay", &st->delay, 1000.0);
+	mq_hist_dump_row ("delay (sched.)", &st->intended_delay, 1000.0);
+	mq_hist_dump_row ("inter-arrival", &st->rx_interval, 1000.0);
+	mq_hist_dump_row ("tx interval", &st->tx_interval, 1000.0);
+	mq_hist_dump_row ("rx jitter", &st->rx_jitter, 1000.0);
+	mq_hist_dump_row ("tx jitter", &st->tx_jitter, 1000.0);
+	if (st->rx_stack.total > 0) {
+		mq_hist_dump_row ("delay (kernel)", &st->kernel_delay, 1000.0);
+		mq_hist_dump_row ("rx stack", &st->rx_stack, 1000.0);
+	}
+	mq_stream_table_dump (&st->streams, 0);
+
+	if (st->num_phases > 1) {
+		for (phase = 0; phase < st->num_phases; phase++) {
+			if (st->delay_phase[phase].count == 0) continue;
+			printf ("Phase %2d delay: %d samples, %ld / %ld / %6.2f usec\n", phase, st->delay_phase[phase].count,
+					st->delay_phase[phase].min, st->delay_phase[phase].max,
+					mq_util_summary_avg (&st->delay_phase[phase]));
+			if (st->tx_jitter_phase[phase].count == 0) continue;
+			printf ("Phase %2d TX: %d pairs, %4ld / %4ld / %6.2f usec\n", phase, st->tx_jitter_phase[phase].count,
+					st->tx_jitter_phase[phase].min, st->tx_jitter_phase[phase].max,
+					mq_util_summary_avg (&st->tx_jitter_phase[phase]));
+			printf ("Phase %2d RX: %d pairs, %4ld / %4ld / %6.2f usec\n", phase, st->rx_jitter_phase[phase].count,
+					st->rx_jitter_phase[phase].min, st->rx_jitter_phase[phase].max,
+					mq_util_summary_avg (&st->rx_jitter_phase[phase]));
+		}
+	}
+}
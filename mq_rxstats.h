@@ -0,0 +1,68 @@
+/*
+ * mq_rxstats.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_RXSTATS_H_
+#define MQ_RXSTATS_H_
+
+#include <stdint.h>
+
+#include "mq_util.h"
+#include "mq_message.h"
+#include "mq_hist.h"
+#include "mq_stream.h"
+#include "mq_report.h"
+#include "mq_capture.h"
+
+/**
+ * statistics of the received messages; histograms are nsec, per phase summaries usec.
+ * fed w/ capture records, live by mqconsumer and offline by mqanalyze, so
+ * both compute the same reports.
+ *
+ * delays are not very reliable when producer and consumer resides on different machines.
+ * even both machines are synchronized w/ NTP, unless the clock offset is estimated (-o)
+ */
+typedef struct MqRxStats {
+	MqHist delay;          // tx -> rx
+	MqHist intended_delay; // scheduled tx -> rx
+	MqHist rx_interval;    // inter-arrival time
+	MqHist tx_interval;
+	MqHist rx_jitter;      // change of consecutive inter-arrival times
+	MqHist tx_jitter;
+	MqHist kernel_delay;   // tx -> kernel rx; producer stack, network and broker
+	MqHist rx_stack;       // kernel rx -> callback; consumer stack
+	MqSummary delay_phase[MQ_MESSAGE_MAX_PHASES];
+	MqSummary rx_jitter_phase[MQ_MESSAGE_MAX_PHASES];
+	MqSummary tx_jitter_phase[MQ_MESSAGE_MAX_PHASES];
+	MqStreamTable streams; // per producer RFC 3550 jitter, delay and inter-arrival moments
+	MqReport report;       // latency: delay, jitter: |D| of consecutive messages
+	uint32_t subscriber;   // the one whose inter-arrival times and jitter are sampled
+	int num_phases;
+	int64_t count;
+} MqRxStats;
+
+/**
+ * bits is the histogram precision; name and the rest are of the interval report.
+ * returns -1 on error
+ */
+int mq_rxstats_init (MqRxStats* st, int bits, const char* name, double report_secs, MqReportFormat format);
+
+void mq_rxstats_destroy (MqRxStats* st);
+
+/**
+ * duplicates are dropped; intervals and jitter are only sampled between
+ * consecutive sequence numbers of a stream (a producer's own clock) so that
+ * losses and reordering do not inflate them, and only for st->subscriber
+ * since the copies of the others interleave w/ its own
+ */
+void mq_rxstats_add (MqRxStats* st, const char* topic, const MqCaptureRecord* rec);
+
+/**
+ * prints the histograms, the streams and the per phase summaries. the kernel
+ * rx segments are printed only if there were kernel stamps
+ */
+void mq_rxstats_dump (const MqRxStats* st);
+
+#endif /* MQ_RXSTATS_H_ */
@@ -0,0 +1,370 @@
+/*
+ * mq_store.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "mq_store.h"
+#include "mq_clock.h"
+#include "mq_log.h"
+
+#define MQ_STORE_ROW_BYTES (sizeof(uint32_t) + sizeof(uint64_t) + 3 * sizeof(int64_t) + sizeof(uint8_t))
+
+// offsets of the columns in a chunk of n samples
+#define MQ_STORE_TXTIME_AT(n)          ((sizeof(uint32_t) + sizeof(uint64_t)) * (n))
+#define MQ_STORE_INTENDED_TXTIME_AT(n) (MQ_STORE_TXTIME_AT(n) + sizeof(int64_t) * (n))
+#define MQ_STORE_RXTIME_AT(n)          (MQ_STORE_INTENDED_TXTIME_AT(n) + sizeof(int64_t) * (n))
+#define MQ_STORE_PHASE_AT(n)           (MQ_STORE_RXTIME_AT(n) + sizeof(int64_t) * (n))
+
+static int column_grow (void** column, uint64_t capacity, size_t size) {
+
+	void* p = realloc (*column, capacity * size);
+
+	if (!p) return -1;
+	*column = p;
+	return 0;
+}
+
+static int store_topic_grow (MqStore* store, MqStoreTopic* t) {
+
+	uint64_t capacity = t->capacity ? 2 * t->capacity : MQ_STORE_MIN_ROWS;
+
+	// a column that grew stays grown; capacity is only raised when all did
+	if (column_grow ((void**) &t->producer, capacity, sizeof(uint32_t)) == -1 ||
+		column_grow ((void**) &t->seq, capacity, sizeof(uint64_t)) == -1 ||
+		column_grow ((void**) &t->txtime, capacity, sizeof(int64_t)) == -1 ||
+		column_grow ((void**) &t->intended_txtime, capacity, sizeof(int64_t)) == -1 ||
+		column_grow ((void**) &t->rxtime, capacity, sizeof(int64_t)) == -1 ||
+		column_grow ((void**) &t->phase, capacity, sizeof(uint8_t)) == -1) {
+		mq_log_error ("Memory for %llu samples of '%s' cannot be allocated!",
+				(unsigned long long) capacity, t->name);
+		return -1;
+	}
+	store->bytes += (capacity - t->capacity) * MQ_STORE_ROW_BYTES;
+	t->capacity = capacity;
+	return 0;
+}
+
+static void store_topic_free (MqStore* store, MqStoreTopic* t) {
+	free (t->producer);
+	free (t->seq);
+	free (t->txtime);
+	free (t->intended_txtime);
+	free (t->rxtime);
+	free (t->phase);
+	t->producer = 0;
+	t->seq = 0;
+	t->txtime = 0;
+	t->intended_txtime = 0;
+	t->rxtime = 0;
+	t->phase = 0;
+	store->bytes -= t->capacity * MQ_STORE_ROW_BYTES;
+	t->capacity = 0;
+}
+
+static int write_at (int fd, const void* buf, size_t len, uint64_t offset) {
+
+	const char* p = (const char*) buf;
+	ssize_t n = 0;
+
+	while (len > 0) {
+		n = pwrite (fd, p, len, (off_t) offset);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static int read_at (int fd, void* buf, size_t len, uint64_t offset) {
+
+	char* p = (char*) buf;
+	ssize_t n = 0;
+
+	while (len > 0) {
+		n = pread (fd, p, len, (off_t) offset);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static int store_spill_open (MqStore* store) {
+
+	char path[sizeof(store->spill_dir) + 32];
+
+	snprintf (path, sizeof(path), "%s/mq_spill.XXXXXX", store->spill_dir);
+	store->spill_fd = mkstemp (path);
+	if (store->spill_fd == -1) {
+		mq_log_error ("Spill file '%s' cannot be created: %s", path, strerror (errno));
+		return -1;
+	}
+	// only the store knows the chunks; nothing to keep once it is gone
+	unlink (path);
+	mq_log_info ("Spilling samples to '%s' (unlinked)", path);
+	return 0;
+}
+
+/**
+ * writes the columns of t to the spill file as a chunk at offset
+ */
+static int store_topic_write (MqStore* store, const MqStoreTopic* t, uint64_t offset) {
+
+	uint64_t n = t->count;
+
+	if (write_at (store->spill_fd, t->producer, n * sizeof(uint32_t), offset) == -1 ||
+		write_at (store->spill_fd, t->seq, n * sizeof(uint64_t), offset + n * sizeof(uint32_t)) == -1 ||
+		write_at (store->spill_fd, t->txtime, n * sizeof(int64_t), offset + MQ_STORE_TXTIME_AT(n)) == -1 ||
+		write_at (store->spill_fd, t->intended_txtime, n * sizeof(int64_t), offset + MQ_STORE_INTENDED_TXTIME_AT(n)) == -1 ||
+		write_at (store->spill_fd, t->rxtime, n * sizeof(int64_t), offset + MQ_STORE_RXTIME_AT(n)) == -1 ||
+		write_at (store->spill_fd, t->phase, n * sizeof(uint8_t), offset + MQ_STORE_PHASE_AT(n)) == -1) {
+		mq_log_error ("Samples of '%s' cannot be spilled: %s", t->name, strerror (errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * moves the samples of the topics that grew beyond MQ_STORE_MIN_ROWS (all
+ * w/ all) to the spill file, followed by the index of the spill, and frees
+ * their columns. all or nothing: the topics are only freed once the index
+ * is written, a failed spill is overwritten by the next
+ */
+static int store_spill (MqStore* store, int all) {
+
+	MqStoreChunk* index = 0;
+	MqStoreTopic* t = 0;
+	uint64_t offset = store->spill_size;
+	int64_t start = mq_clock_now ();
+	int capacity = 0;
+	int spilled = 0;
+	int result = -1;
+	void* p = 0;
+	int i = 0;
+
+	if (store->spill_fd == -1 && store_spill_open (store) == -1) {
+		return -1;
+	}
+	if (store->num_spills == store->spill_capacity) {
+		capacity = store->spill_capacity ? 2 * store->spill_capacity : 16;
+		if (!(p = realloc (store->spills, capacity * sizeof(MqStoreSpill)))) {
+			mq_log_error ("Memory for %d spills cannot be allocated!", capacity);
+			return -1;
+		}
+		store->spills = (MqStoreSpill*) p;
+		store->bytes += (capacity - store->spill_capacity) * sizeof(MqStoreSpill);
+		store->spill_capacity = capacity;
+	}
+	index = (MqStoreChunk*) calloc (store->num_topics, sizeof(MqStoreChunk));
+	if (!index) {
+		mq_log_error ("Memory for the index of %d topics cannot be allocated!", store->num_topics);
+		return -1;
+	}
+	for (i = 0; i < store->num_topics; i++) {
+		t = store->topics + i;
+		if (t->count == 0 || (!all && t->capacity <= MQ_STORE_MIN_ROWS)) continue;
+		if (store_topic_write (store, t, offset) == -1) goto cleanup;
+		index[i].offset = offset;
+		index[i].count = t->count;
+		offset += t->count * MQ_STORE_ROW_BYTES;
+		spilled++;
+	}
+	result = 0;
+	if (spilled == 0) goto cleanup;
+	if (write_at (store->spill_fd, index, store->num_topics * sizeof(MqStoreChunk), offset) == -1) {
+		mq_log_error ("Index of a spill cannot be written: %s", strerror (errno));
+		result = -1;
+		goto cleanup;
+	}
+	store->spills[store->num_spills].index_offset = offset;
+	store->spills[store->num_spills].num_topics = store->num_topics;
+	store->num_spills++;
+	store->spill_size = offset + store->num_topics * sizeof(MqStoreChunk);
+	for (i = 0; i < store->num_topics; i++) {
+		if (index[i].count == 0) continue;
+		t = store->topics + i;
+		t->spilled += t->count;
+		store->spilled += t->count;
+		t->count = 0;
+		store_topic_free (store, t);
+	}
+
+	/* CLEANUP LABEL*/
+	cleanup:
+
+	free (index);
+	store->spill_nsec += mq_clock_now () - start;
+	return result;
+}
+
+void mq_store_init (MqStore* store, size_t budget, const char* spill_dir) {
+	memset (store, 0, sizeof(MqStore));
+	store->budget = budget;
+	store->spill_fd = -1;
+	strncpy (store->spill_dir, spill_dir ? spill_dir : ".", sizeof(store->spill_dir) - 1);
+}
+
+int mq_store_append (MqStore* store, int id, const char* name, const MqCaptureRecord* rec) {
+
+	MqStoreTopic* t = 0;
+	uint64_t growth = 0;
+	int capacity = 0;
+	int all = 0;
+	void* p = 0;
+
+	if (id >= store->capacity) {
+		capacity = store->capacity ? 2 * store->capacity : 64;
+		while (capacity <= id) capacity *= 2;
+		if (!(p = realloc (store->topics, capacity * sizeof(MqStoreTopic)))) {
+			mq_log_error ("Memory for %d topics cannot be allocated!", capacity);
+			return -1;
+		}
+		store->topics = (MqStoreTopic*) p;
+		memset (store->topics + store->capacity, 0, (capacity - store->capacity) * sizeof(MqStoreTopic));
+		store->capacity = capacity;
+	}
+	if (id >= store->num_topics) {
+		store->num_topics = id + 1;
+	}
+	t = store->topics + id;
+	t->name = name;
+	// the few samples of the small topics go only if the large ones did not free enough
+	for (all = 0; store->budget && t->count == t->capacity && all < 2; all++) {
+		growth = (t->capacity ? t->capacity : MQ_STORE_MIN_ROWS) * MQ_STORE_ROW_BYTES;
+		if (store->bytes + growth <= store->budget || store->bytes == 0) break;
+		if (store->spill_failed) return -1;
+		if (store_spill (store, all) == -1) {
+			mq_log_error ("Spilling stopped, samples beyond the budget are dropped");
+			store->spill_failed = 1;
+			return -1;
+		}
+	}
+	if (t->count == t->capacity && store_topic_grow (store, t) == -1) {
+		return -1;
+	}
+	t->producer[t->count] = rec->producer;
+	t->seq[t->count] = rec->seq;
+	t->txtime[t->count] = rec->txtime;
+	t->intended_txtime[t->count] = rec->intended_txtime;
+	t->rxtime[t->count] = rec->rxtime_tx;
+	t->phase[t->count] = rec->phase;
+	t->count++;
+	store->count++;
+	return 0;
+}
+
+size_t mq_store_bytes (const MqStore* store) {
+	return store->capacity * sizeof(MqStoreTopic) + store->bytes;
+}
+
+void mq_store_destroy (MqStore* store) {
+
+	int i = 0;
+
+	for (i = 0; i < store->num_topics; i++) {
+		store_topic_free (store, store->topics + i);
+	}
+	free (store->topics);
+	free (store->spills);
+	if (store->spill_fd != -1) {
+		close (store->spill_fd);
+	}
+	memset (store, 0, sizeof(MqStore));
+	store->spill_fd = -1;
+}
+
+int mq_store_cursor_init (MqStoreCursor* cursor, const MqStore* store) {
+	memset (cursor, 0, sizeof(MqStoreCursor));
+	cursor->store = store;
+	if (store->spilled == 0) return 0;
+	cursor->buffer = (int64_t*) malloc (MQ_STORE_READ_ROWS * (3 * sizeof(int64_t) + sizeof(uint8_t)));
+	if (!cursor->buffer) {
+		mq_log_error ("Memory for reading the spill file cannot be allocated!");
+		return -1;
+	}
+	return 0;
+}
+
+void mq_store_cursor_start (MqStoreCursor* cursor, const MqStoreTopic* topic) {
+	cursor->topic = topic;
+	cursor->spill = -1;
+	cursor->chunk.offset = 0;
+	cursor->chunk.count = 0;
+	cursor->pos = 0;
+	cursor->left = topic->spilled;
+	cursor->count = 0;
+}
+
+int mq_store_cursor_next (MqStoreCursor* cursor) {
+
+	const MqStore* store = cursor->store;
+	const MqStoreTopic* t = cursor->topic;
+	const MqStoreSpill* spill = 0;
+	int id = (int) (t - store->topics);
+	int fd = store->spill_fd;
+	uint64_t n = 0;
+	uint64_t k = 0;
+	uint64_t at = 0;
+
+	// to the next spill w/ samples of the topic
+	while (cursor->pos == cursor->chunk.count && cursor->spill < store->num_spills) {
+		cursor->pos = 0;
+		cursor->chunk.count = 0;
+		cursor->spill = cursor->left > 0 ? cursor->spill + 1 : store->num_spills;
+		if (cursor->spill == store->num_spills) break;
+		spill = store->spills + cursor->spill;
+		if ((uint64_t) id >= spill->num_topics) continue;
+		if (read_at (fd, &cursor->chunk, sizeof(MqStoreChunk), spill->index_offset + id * sizeof(MqStoreChunk)) == -1) {
+			mq_log_error ("Index of a spill cannot be read back: %s", strerror (errno));
+			return -1;
+		}
+	}
+	if (cursor->spill >= store->num_spills) {
+		// the samples in memory, in one block
+		if (cursor->spill > store->num_spills || t->count == 0) return 0;
+		cursor->spill++;
+		cursor->count = t->count;
+		cursor->txtime = t->txtime;
+		cursor->intended_txtime = t->intended_txtime;
+		cursor->rxtime = t->rxtime;
+		cursor->phase = t->phase;
+		return 1;
+	}
+	n = cursor->chunk.count;
+	k = n - cursor->pos < MQ_STORE_READ_ROWS ? n - cursor->pos : MQ_STORE_READ_ROWS;
+	at = cursor->chunk.offset;
+	if (read_at (fd, cursor->buffer, k * sizeof(int64_t), at + MQ_STORE_TXTIME_AT(n) + cursor->pos * sizeof(int64_t)) == -1 ||
+		read_at (fd, cursor->buffer + MQ_STORE_READ_ROWS, k * sizeof(int64_t),
+				at + MQ_STORE_INTENDED_TXTIME_AT(n) + cursor->pos * sizeof(int64_t)) == -1 ||
+		read_at (fd, cursor->buffer + 2 * MQ_STORE_READ_ROWS, k * sizeof(int64_t),
+				at + MQ_STORE_RXTIME_AT(n) + cursor->pos * sizeof(int64_t)) == -1 ||
+		read_at (fd, cursor->buffer + 3 * MQ_STORE_READ_ROWS, k * sizeof(uint8_t),
+				at + MQ_STORE_PHASE_AT(n) + cursor->pos * sizeof(uint8_t)) == -1) {
+		mq_log_error ("Samples of '%s' cannot be read back from the spill file: %s", t->name, strerror (errno));
+		return -1;
+	}
+	cursor->count = k;
+	cursor->txtime = cursor->buffer;
+	cursor->intended_txtime = cursor->buffer + MQ_STORE_READ_ROWS;
+	cursor->rxtime = cursor->buffer + 2 * MQ_STORE_READ_ROWS;
+	cursor->phase = (const uint8_t*) (cursor->buffer + 3 * MQ_STORE_READ_ROWS);
+	cursor->pos += k;
+	cursor->left -= k;
+	return 1;
+}
+
+void mq_store_cursor_destroy (MqStoreCursor* cursor) {
+	free (cursor->buffer);
+	cursor->buffer = 0;
+}
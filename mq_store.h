@@ -0,0 +1,142 @@
+/*
+ * mq_store.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_STORE_H_
+#define MQ_STORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mq_capture.h"
+
+#define MQ_STORE_MIN_ROWS 64 // first allocation of a topic's columns; 2.3 KiB, small for 10k topic runs
+#define MQ_STORE_READ_ROWS 65536 // samples a cursor reads from the spill file at a time
+
+/**
+ * samples of a topic moved to the spill file; the columns follow each other
+ * from offset, in the order of MqStoreTopic. every spill ends w/ an index of
+ * a chunk per topic id (count 0 if the topic stayed in memory)
+ */
+typedef struct MqStoreChunk {
+	uint64_t offset;
+	uint64_t count;
+} MqStoreChunk;
+
+/**
+ * where the index of a spill is in the spill file; all the store keeps in
+ * memory of a spill
+ */
+typedef struct MqStoreSpill {
+	uint64_t index_offset;
+	uint64_t num_topics; // chunks in the index
+} MqStoreSpill;
+
+/**
+ * the samples of a topic, one array per field; 37 bytes a sample. times
+ * are nsec since the epoch, rxtime in the producer's clock. the oldest
+ * samples are in the spills when the store spilled
+ */
+typedef struct MqStoreTopic {
+	const char* name;   // not owned, NULL until the first sample
+	uint64_t count;     // in memory
+	uint64_t capacity;
+	uint32_t* producer;
+	uint64_t* seq;
+	int64_t* txtime;
+	int64_t* intended_txtime;
+	int64_t* rxtime;
+	uint8_t* phase;
+	uint64_t spilled;   // in the spill file
+} MqStoreTopic;
+
+/**
+ * in-memory columnar store of the received samples, indexed by topic id
+ * (mq_topic_id). the columns double when full; owned by a single thread
+ * while samples are appended, read only after that.
+ *
+ * w/ a budget the columns of the grown topics (of all if that is not
+ * enough) are appended to a spill file and freed whenever growing one would
+ * exceed it, so the memory of the store stays below the budget (and the
+ * MQ_STORE_MIN_ROWS of each topic) however long the run is; a spill costs
+ * an MqStoreSpill of memory, counted in the budget. the spill file is
+ * unlinked as soon as it is created.
+ */
+typedef struct MqStore {
+	MqStoreTopic* topics;
+	int num_topics;      // highest id + 1
+	int capacity;
+	uint64_t count;      // samples in all topics, spilled or not
+	size_t bytes;        // of the columns and the spills in memory
+	size_t budget;       // 0: no limit
+	int spill_fd;        // -1 until the first spill
+	char spill_dir[1024];
+	uint64_t spill_size; // bytes in the spill file
+	uint64_t spilled;    // samples
+	MqStoreSpill* spills;
+	int num_spills;
+	int spill_capacity;
+	int64_t spill_nsec;  // spent writing the spill file
+	int spill_failed;    // no more spills, the topics cannot grow beyond the budget
+} MqStore;
+
+/**
+ * walks the samples of a topic, MQ_STORE_READ_ROWS at a time, in the order
+ * they were appended. the columns point into the store or into the buffers
+ * of the cursor, valid until the next call. cursors on different threads
+ * can read the same store
+ */
+typedef struct MqStoreCursor {
+	const MqStore* store;
+	const MqStoreTopic* topic;
+	int spill;           // num_spills: the samples in memory
+	MqStoreChunk chunk;  // of the topic in the spill
+	uint64_t pos;        // in the chunk
+	uint64_t left;       // spilled samples not read yet
+	uint64_t count;      // samples in the columns below
+	const int64_t* txtime;
+	const int64_t* intended_txtime;
+	const int64_t* rxtime;
+	const uint8_t* phase;
+	int64_t* buffer;     // 3 * MQ_STORE_READ_ROWS times, then the phases; only if the store spilled
+} MqStoreCursor;
+
+/**
+ * budget in bytes, 0: unlimited. the spill file is created in spill_dir
+ */
+void mq_store_init (MqStore* store, size_t budget, const char* spill_dir);
+
+/**
+ * appends the sample of rec (rxtime_tx as the rx time) to the topic w/ id.
+ * name must outlive the store. returns -1 if there is no memory (or disk) for it.
+ * after the first failed spill nothing is spilled and the topics stay in the budget
+ */
+int mq_store_append (MqStore* store, int id, const char* name, const MqCaptureRecord* rec);
+
+/**
+ * bytes allocated for the samples in memory
+ */
+size_t mq_store_bytes (const MqStore* store);
+
+void mq_store_destroy (MqStore* store);
+
+/**
+ * returns -1 if the buffers of the cursor cannot be allocated
+ */
+int mq_store_cursor_init (MqStoreCursor* cursor, const MqStore* store);
+
+/**
+ * (re)starts the cursor at the first sample of topic
+ */
+void mq_store_cursor_start (MqStoreCursor* cursor, const MqStoreTopic* topic);
+
+/**
+ * the next block of samples; 1 if there is one, 0 at the end, -1 on error
+ */
+int mq_store_cursor_next (MqStoreCursor* cursor);
+
+void mq_store_cursor_destroy (MqStoreCursor* cursor);
+
+#endif /* MQ_STORE_H_ */
@@ -0,0 +1,315 @@
+/*
+ * mq_stream.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "mq_stream.h"
+#include "mq_log.h"
+
+void mq_moments_init (MqMoments* m) {
+	m->count = 0;
+	m->mean = 0.0;
+	m->m2 = 0.0;
+}
+
+void mq_moments_add (MqMoments* m, double x) {
+	double delta = x - m->mean;
+
+	m->count++;
+	m->mean += delta / m->count;
+	m->m2 += delta * (x - m->mean);
+}
+
+double mq_moments_variance (const MqMoments* m) {
+	return m->count > 1 ? m->m2 / (m->count - 1) : 0.0;
+}
+
+double mq_moments_stddev (const MqMoments* m) {
+	return sqrt (mq_moments_variance (m));
+}
+
+static int depth_bucket (uint64_t depth) {
+	int b = 63 - __builtin_clzll (depth);
+	return b < MQ_STREAM_DEPTH_BUCKETS ? b : MQ_STREAM_DEPTH_BUCKETS - 1;
+}
+
+#define WINDOW_WORD(seq) (((seq) % MQ_STREAM_WINDOW_BITS) / 64)
+#define WINDOW_BIT(seq) (1ULL << ((seq) % 64))
+
+static MqStreamArrival track (MqStream* stream, uint64_t seq) {
+
+	uint64_t s = 0;
+	uint64_t depth = 0;
+
+	if (stream->count == 0) {
+		stream->first_seq = seq;
+		stream->highest_seq = seq;
+		stream->window[WINDOW_WORD (seq)] |= WINDOW_BIT (seq);
+		return MQ_STREAM_IN_ORDER;
+	}
+
+	if (seq > stream->highest_seq) {
+		// slide; bits of the sequence numbers leaving the window are reused
+		if (seq - stream->highest_seq >= MQ_STREAM_WINDOW_BITS) {
+			memset (stream->window, 0, sizeof(stream->window));
+		} else {
+			for (s = stream->highest_seq + 1; s < seq; s++) {
+				stream->window[WINDOW_WORD (s)] &= ~WINDOW_BIT (s);
+			}
+		}
+		stream->window[WINDOW_WORD (seq)] |= WINDOW_BIT (seq);
+		depth = seq - stream->highest_seq;
+		stream->highest_seq = seq;
+		return depth == 1 ? MQ_STREAM_IN_ORDER : MQ_STREAM_GAP;
+	}
+
+	if (seq < stream->first_seq) stream->first_seq = seq;
+
+	depth = stream->highest_seq - seq;
+	if (depth >= MQ_STREAM_WINDOW_BITS) {
+		stream->late++;
+		return MQ_STREAM_LATE;
+	}
+	if (stream->window[WINDOW_WORD (seq)] & WINDOW_BIT (seq)) {
+		stream->duplicates++;
+		return MQ_STREAM_DUPLICATE;
+	}
+	stream->window[WINDOW_WORD (seq)] |= WINDOW_BIT (seq);
+	stream->reordered++;
+	stream->reorder_depth[depth_bucket (depth)]++;
+	if ((int64_t) depth > stream->max_reorder_depth) stream->max_reorder_depth = (int64_t) depth;
+	return MQ_STREAM_REORDERED;
+}
+
+MqStreamArrival mq_stream_add (MqStream* stream, uint64_t seq, int64_t transit, int64_t rxtime) {
+
+	MqStreamArrival arrival = track (stream, seq);
+	int64_t d = 0;
+
+	if (arrival == MQ_STREAM_DUPLICATE) {
+		return arrival;
+	}
+	mq_moments_add (&stream->delay, (double) transit);
+
+	if (arrival == MQ_STREAM_IN_ORDER && stream->count > 0) {
+		d = transit - stream->last_transit;
+		stream->jitter += ((double) (d < 0 ? -d : d) - stream->jitter) / 16.0;
+		mq_moments_add (&stream->interarrival, (double) (rxtime - stream->last_rxtime));
+	}
+	if (arrival == MQ_STREAM_IN_ORDER || arrival == MQ_STREAM_GAP) {
+		stream->last_transit = transit;
+		stream->last_rxtime = rxtime;
+	}
+	stream->count++;
+	return arrival;
+}
+
+int64_t mq_stream_lost (const MqStream* stream) {
+	if (stream->count == 0) return 0;
+	return (int64_t) (stream->highest_seq - stream->first_seq + 1) - stream->count;
+}
+
+int mq_stream_table_init (MqStreamTable* table) {
+	table->capacity = MQ_STREAM_TABLE_INITIAL_CAPACITY;
+	table->count = 0;
+	table->streams = (MqStream*) calloc (table->capacity, sizeof(MqStream));
+	if (!table->streams) {
+		mq_log_error ("Memory for streams cannot be allocated!");
+		return -1;
+	}
+	return 0;
+}
+
+void mq_stream_table_destroy (MqStreamTable* table) {
+
+	int i = 0;
+
+	if (!table->streams) return;
+	for (i = 0; i < table->capacity; i++) {
+		free (table->streams[i].topic);
+	}
+	free (table->streams);
+	table->streams = 0;
+	table->count = 0;
+}
+
+/* slot of the stream, or the empty slot it would go to */
+static int find_slot (const MqStream* streams, int capacity, uint32_t producer, uint32_t subscriber) {
+
+	int i = (int) (((producer ^ (subscriber * 0x9e3779b9u)) * 2654435761u) & (capacity - 1));
+
+	while (streams[i].topic && (streams[i].producer != producer || streams[i].subscriber != subscriber)) {
+		i = (i + 1) & (capacity - 1);
+	}
+	return i;
+}
+
+static int grow (MqStreamTable* table) {
+
+	int capacity = 2 * table->capacity;
+	MqStream* streams = (MqStream*) calloc (capacity, sizeof(MqStream));
+	const MqStream* s = 0;
+	int i = 0;
+
+	if (!streams) {
+		mq_log_error ("Memory for streams cannot be allocated!");
+		return -1;
+	}
+	for (i = 0; i < table->capacity; i++) {
+		s = table->streams + i;
+		if (s->topic) {
+			streams[find_slot (streams, capacity, s->producer, s->subscriber)] = *s;
+		}
+	}
+	free (table->streams);
+	table->streams = streams;
+	table->capacity = capacity;
+	return 0;
+}
+
+MqStream* mq_stream_table_get (MqStreamTable* table, uint32_t producer, uint32_t subscriber, const char* topic) {
+
+	MqStream* stream = table->streams + find_slot (table->streams, table->capacity, producer, subscriber);
+
+	if (stream->topic) {
+		return stream;
+	}
+	// keep the load below 1/2
+	if (2 * (table->count + 1) > table->capacity) {
+		if (grow (table) == -1) return 0;
+		stream = table->streams + find_slot (table->streams, table->capacity, producer, subscriber);
+	}
+	memset (stream, 0, sizeof(MqStream));
+	stream->topic = strdup (topic);
+	if (!stream->topic) {
+		mq_log_error ("Memory for streams cannot be allocated!");
+		return 0;
+	}
+	stream->producer = producer;
+	stream->subscriber = subscriber;
+	if (subscriber > 0) table->fanout = 1;
+	mq_moments_init (&stream->delay);
+	mq_moments_init (&stream->interarrival);
+	table->count++;
+	return stream;
+}
+
+int64_t mq_stream_table_lost (const MqStreamTable* table) {
+
+	int64_t lost = 0;
+	int i = 0;
+
+	for (i = 0; i < table->capacity; i++) {
+		if (table->streams[i].topic) lost += mq_stream_lost (table->streams + i);
+	}
+	return lost;
+}
+
+/* producer, or producer/subscriber when there are more than one subscriber */
+static const char* stream_name (const MqStreamTable* table, const MqStream* s, char* buf, int len) {
+	if (table->fanout) {
+		snprintf (buf, len, "%" PRIu32 "/%" PRIu32, s->producer, s->subscriber);
+	} else {
+		snprintf (buf, len, "%" PRIu32, s->producer);
+	}
+	return buf;
+}
+
+void mq_stream_dump (const MqStreamTable* table, const MqStream* const* streams, int num_streams) {
+
+	const MqStream* s = 0;
+	char name[32];
+	int64_t lost = 0;
+	int64_t all_lost = 0;
+	int i = 0;
+	int b = 0;
+	int rows = 0;
+	MqStream all; // totals; delay is weighted by the messages, jitter is the mean of the streams'
+
+	memset (&all, 0, sizeof(MqStream));
+	printf ("Streams (usec) ----------------------------------------\n");
+	printf ("%-16s %10s %10s %12s %12s %12s %12s  %s\n", table->fanout ? "producer/sub" : "producer",
+			"messages", "jitter", "delay avg", "delay sd", "inter avg", "inter sd", "topic");
+	for (i = 0; i < num_streams; i++) {
+		s = streams[i];
+		all.count += s->count;
+		all.jitter += s->jitter;
+		all.delay.mean += s->delay.mean * s->delay.count;
+		all_lost += mq_stream_lost (s);
+		all.late += s->late;
+		all.reordered += s->reordered;
+		all.duplicates += s->duplicates;
+		if (s->max_reorder_depth > all.max_reorder_depth) all.max_reorder_depth = s->max_reorder_depth;
+		if (rows++ >= MQ_STREAM_DUMP_MAX_ROWS) continue;
+		printf ("%-16s %10" PRId64 " %10.1f %12.1f %12.1f %12.1f %12.1f  %s\n",
+				stream_name (table, s, name, sizeof(name)), s->count,
+				s->jitter / 1000.0,
+				s->delay.mean / 1000.0, mq_moments_stddev (&s->delay) / 1000.0,
+				s->interarrival.mean / 1000.0, mq_moments_stddev (&s->interarrival) / 1000.0,
+				s->topic);
+	}
+	if (num_streams > MQ_STREAM_DUMP_MAX_ROWS) {
+		printf ("... %d more streams\n", num_streams - MQ_STREAM_DUMP_MAX_ROWS);
+	}
+	if (num_streams > 1) {
+		printf ("%-16s %10" PRId64 " %10.1f %12.1f  (%d streams)\n", "all", all.count,
+				all.jitter / num_streams / 1000.0, all.count ? all.delay.mean / all.count / 1000.0 : 0.0, num_streams);
+	}
+
+	rows = 0;
+	printf ("Sequence ----------------------------------------------\n");
+	printf ("%-16s %10s %10s %8s %10s %10s %10s %10s\n", table->fanout ? "producer/sub" : "producer",
+			"expected", "lost", "loss %", "reordered", "max depth", "duplicate", "late");
+	for (i = 0; i < num_streams; i++) {
+		s = streams[i];
+		if (rows++ >= MQ_STREAM_DUMP_MAX_ROWS) break;
+		lost = mq_stream_lost (s);
+		stream_name (table, s, name, sizeof(name));
+		printf ("%-16s %10" PRId64 " %10" PRId64 " %8.3f %10" PRId64 " %10" PRId64 " %10" PRId64 " %10" PRId64 "\n",
+				name, s->count + lost, lost, s->count ? 100.0 * lost / (s->count + lost) : 0.0,
+				s->reordered, s->max_reorder_depth, s->duplicates, s->late);
+		if (s->reordered == 0) continue;
+		printf ("%-16s reorder depth", name);
+		for (b = 0; b < MQ_STREAM_DEPTH_BUCKETS; b++) {
+			if (s->reorder_depth[b] == 0) continue;
+			printf (" %d-%d:%" PRId64, 1 << b, (2 << b) - 1, s->reorder_depth[b]);
+		}
+		printf ("\n");
+	}
+	if (num_streams > MQ_STREAM_DUMP_MAX_ROWS) {
+		printf ("... %d more streams\n", num_streams - MQ_STREAM_DUMP_MAX_ROWS);
+	}
+	if (num_streams > 1) {
+		printf ("%-16s %10" PRId64 " %10" PRId64 " %8.3f %10" PRId64 " %10" PRId64 " %10" PRId64 " %10" PRId64 "\n", "all",
+				all.count + all_lost, all_lost, all.count ? 100.0 * all_lost / (all.count + all_lost) : 0.0,
+				all.reordered, all.max_reorder_depth, all.duplicates, all.late);
+	}
+}
+
+void mq_stream_table_dump (const MqStreamTable* table, const char* topic) {
+
+	const MqStream** streams = 0;
+	const MqStream* s = 0;
+	int num_streams = 0;
+	int i = 0;
+
+	streams = (const MqStream**) malloc ((table->count ? table->count : 1) * sizeof(MqStream*));
+	if (!streams) {
+		mq_log_error ("Memory for %d streams cannot be allocated!", table->count);
+		return;
+	}
+	for (i = 0; i < table->capacity; i++) {
+		s = table->streams + i;
+		if (!s->topic || (topic && strcmp (s->topic, topic) != 0)) continue;
+		streams[num_streams++] = s;
+	}
+	mq_stream_dump (table, streams, num_streams);
+	free (streams);
+}
@@ -0,0 +1,151 @@
+/*
+ * mq_stream.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_STREAM_H_
+#define MQ_STREAM_H_
+
+#include <stdint.h>
+
+/**
+ * running mean and variance (Welford); numerically stable, O(1) per sample
+ */
+typedef struct MqMoments {
+	int64_t count;
+	double mean;
+	double m2; // sum of squared differences from the mean
+} MqMoments;
+
+void mq_moments_init (MqMoments* m);
+
+void mq_moments_add (MqMoments* m, double x);
+
+/**
+ * sample variance, 0 for less than two samples
+ */
+double mq_moments_variance (const MqMoments* m);
+
+double mq_moments_stddev (const MqMoments* m);
+
+/**
+ * sequence numbers within this distance of the highest received one are
+ * tracked individually; older arrivals can not be told from duplicates.
+ */
+#define MQ_STREAM_WINDOW_BITS 1024
+#define MQ_STREAM_WINDOW_WORDS (MQ_STREAM_WINDOW_BITS / 64)
+#define MQ_STREAM_DEPTH_BUCKETS 10 // reorder depth 1, 2-3, 4-7, ... 512-1023
+
+/**
+ * how a message arrived relative to those before it
+ */
+typedef enum MqStreamArrival {
+	MQ_STREAM_IN_ORDER = 0, // next sequence number
+	MQ_STREAM_GAP,          // ahead of the next, the ones in between are missing (so far)
+	MQ_STREAM_REORDERED,    // fills a gap within the window
+	MQ_STREAM_LATE,         // older than the window
+	MQ_STREAM_DUPLICATE     // already received
+} MqStreamArrival;
+
+/**
+ * streaming statistics of the messages of a single producer, updated in O(1)
+ * per message and valid at any moment of the run. times are nsec.
+ *
+ * jitter is the RFC 3550 (6.4.1) interarrival jitter:
+ *   D(i-1,i) = (R_i - R_i-1) - (S_i - S_i-1) = transit_i - transit_i-1
+ *   J += (|D(i-1,i)| - J) / 16
+ * w/ S the producer's send stamps and R the rx times; a constant clock
+ * offset between producer and consumer cancels out. it is only updated
+ * between consecutive sequence numbers, so a lost message does not show up
+ * as a long inter-arrival time.
+ *
+ * loss is the number of sequence numbers between the lowest and the highest
+ * received ones that did not arrive (yet); a late reordered message lowers it.
+ */
+typedef struct MqStream {
+	uint32_t producer;
+	uint32_t subscriber;   // receiving client, when one process runs more than one
+	char* topic;           // of the first message
+	int64_t count;         // received, w/o duplicates
+	int64_t last_rxtime;   // of the highest sequence number
+	int64_t last_transit;
+	double jitter;         // J
+	MqMoments delay;       // transit times
+	MqMoments interarrival;
+
+	uint64_t first_seq;    // lowest received
+	uint64_t highest_seq;
+	uint64_t window[MQ_STREAM_WINDOW_WORDS]; // received bits, seq % MQ_STREAM_WINDOW_BITS
+	int64_t reordered;
+	int64_t duplicates;
+	int64_t late;
+	int64_t max_reorder_depth;
+	int64_t reorder_depth[MQ_STREAM_DEPTH_BUCKETS];
+
+	// tx / rx intervals of consecutive messages, kept by mq_rxstats
+	int64_t interval_count; // consecutive messages so far
+	int64_t previous_txtime;
+	int64_t previous_rxtime;
+	int64_t previous_tx_dt;
+	int64_t previous_rx_dt;
+} MqStream;
+
+/**
+ * seq is the producer's sequence number, transit the delay (rx time in the
+ * producer's clock - send stamp), rxtime the rx time in the consumer's clock.
+ * duplicates are only counted, they do not add to the statistics.
+ */
+MqStreamArrival mq_stream_add (MqStream* stream, uint64_t seq, int64_t transit, int64_t rxtime);
+
+/**
+ * sequence numbers missing so far
+ */
+int64_t mq_stream_lost (const MqStream* stream);
+
+/**
+ * streams by producer id and subscriber; open addressing hash table that
+ * grows as needed
+ */
+typedef struct MqStreamTable {
+	MqStream* streams;
+	int capacity;     // power of two
+	int count;
+	int fanout;       // there are streams of subscribers other than 0
+} MqStreamTable;
+
+#define MQ_STREAM_TABLE_INITIAL_CAPACITY 64
+#define MQ_STREAM_DUMP_MAX_ROWS 32
+
+/**
+ * returns -1 on error
+ */
+int mq_stream_table_init (MqStreamTable* table);
+
+void mq_stream_table_destroy (MqStreamTable* table);
+
+/**
+ * stream of the producer as received by the subscriber, created on its first
+ * message. the pointer is valid until the next stream is created. returns 0
+ * on error
+ */
+MqStream* mq_stream_table_get (MqStreamTable* table, uint32_t producer, uint32_t subscriber, const char* topic);
+
+/**
+ * sequence numbers missing so far, of all streams
+ */
+int64_t mq_stream_table_lost (const MqStreamTable* table);
+
+/**
+ * prints num_streams streams of the table, the first MQ_STREAM_DUMP_MAX_ROWS
+ * of them and the totals
+ */
+void mq_stream_dump (const MqStreamTable* table, const MqStream* const* streams, int num_streams);
+
+/**
+ * prints the streams of the topic, or all streams if topic is 0. scans the
+ * whole table, see mq_stream_dump for the streams of many topics
+ */
+void mq_stream_table_dump (const MqStreamTable* table, const char* topic);
+
+#endif /* MQ_STREAM_H_ */
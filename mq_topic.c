@@ -0,0 +1,93 @@
+/*
+ * mq_topic.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mq_topic.h"
+#include "mq_log.h"
+
+static uint32_t topic_hash (const char* topic) {
+
+	uint32_t h = 2166136261u; // FNV-1a
+	const char* c = 0;
+
+	for (c = topic; *c; c++) {
+		h = (h ^ (unsigned char) *c) * 16777619u;
+	}
+	return h;
+}
+
+/**
+ * doubles the slots (and the names) and re-inserts the ids
+ */
+static int topic_table_grow (MqTopicTable* table) {
+
+	int num_slots = table->num_slots ? 2 * table->num_slots : MQ_TOPIC_TABLE_MIN_SLOTS;
+	int* slots = calloc (num_slots, sizeof(int));
+	char** names = realloc (table->names, (num_slots / 2) * sizeof(char*));
+	int id = 0;
+	int i = 0;
+
+	if (names) table->names = names;
+	if (!slots || !names) {
+		mq_log_error ("Memory for %d topics cannot be allocated!", num_slots / 2);
+		free (slots);
+		return -1;
+	}
+	for (id = 0; id < table->count; id++) {
+		for (i = topic_hash (names[id]) & (num_slots - 1); slots[i]; i = (i + 1) & (num_slots - 1));
+		slots[i] = id + 1;
+	}
+	free (table->slots);
+	table->slots = slots;
+	table->num_slots = num_slots;
+	return 0;
+}
+
+int mq_topic_id (MqTopicTable* table, const char* topic) {
+
+	uint32_t h = topic_hash (topic);
+	char* name = 0;
+	int i = 0;
+
+	if (table->num_slots == 0 && topic_table_grow (table) == -1) {
+		return -1;
+	}
+	for (i = h & (table->num_slots - 1); table->slots[i]; i = (i + 1) & (table->num_slots - 1)) {
+		if (strcmp (table->names[table->slots[i] - 1], topic) == 0) return table->slots[i] - 1;
+	}
+	if (2 * (table->count + 1) > table->num_slots) {
+		if (topic_table_grow (table) == -1) return -1;
+		for (i = h & (table->num_slots - 1); table->slots[i]; i = (i + 1) & (table->num_slots - 1));
+	}
+	if (!(name = strdup (topic))) {
+		return -1;
+	}
+	table->names[table->count] = name;
+	table->slots[i] = ++table->count;
+	return table->count - 1;
+}
+
+const char* mq_topic_intern (MqTopicTable* table, const char* topic) {
+
+	int id = mq_topic_id (table, topic);
+
+	return id == -1 ? "(other)" : table->names[id];
+}
+
+void mq_topic_table_destroy (MqTopicTable* table) {
+
+	int id = 0;
+
+	for (id = 0; id < table->count; id++) {
+		free (table->names[id]);
+	}
+	free (table->names);
+	free (table->slots);
+	memset (table, 0, sizeof(MqTopicTable));
+}
@@ -0,0 +1,42 @@
+/*
+ * mq_topic.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_TOPIC_H_
+#define MQ_TOPIC_H_
+
+#define MQ_TOPIC_TABLE_MIN_SLOTS 1024 // power of two; the table doubles when half full
+
+/**
+ * interned topic names and their ids, 0.. in the order they are first seen,
+ * so that records handed over to another thread can refer to a topic w/ a
+ * pointer or an int. open addressing; owned by a single thread, a zeroed
+ * table is empty. the copies live until the table is destroyed, the names
+ * array moves when it grows
+ */
+typedef struct MqTopicTable {
+	char** names;   // by id
+	int* slots;     // id + 1
+	int num_slots;
+	int count;
+} MqTopicTable;
+
+/**
+ * id of topic, added if it is new. -1 if there is no memory for it
+ */
+int mq_topic_id (MqTopicTable* table, const char* topic);
+
+/**
+ * the copy of topic in the table, "(other)" if there is no memory for it
+ */
+const char* mq_topic_intern (MqTopicTable* table, const char* topic);
+
+static inline const char* mq_topic_name (const MqTopicTable* table, int id) {
+	return table->names[id];
+}
+
+void mq_topic_table_destroy (MqTopicTable* table);
+
+#endif /* MQ_TOPIC_H_ */
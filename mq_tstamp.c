@@ -0,0 +1,151 @@
+/*
+ * mq_tstamp.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#ifdef MOSQ_LINUX
+  #include <linux/net_tstamp.h>
+  #include <linux/errqueue.h>
+#endif
+
+#include "mq_tstamp.h"
+#include "mq_clock.h"
+#include "mq_log.h"
+
+#define MQ_TSTAMP_CONTROL_LEN 512
+#define MQ_TSTAMP_MAX_DRAIN 64 // error queue messages read per collect
+
+#ifdef MOSQ_LINUX
+
+/* software stamp of the message in the mq_clock source, 0 if it has none */
+static int64_t cmsg_tstamp (struct msghdr* msg) {
+
+	struct cmsghdr* cm = 0;
+	struct scm_timestamping ts;
+
+	for (cm = CMSG_FIRSTHDR (msg); cm; cm = CMSG_NXTHDR (msg, cm)) {
+		if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+			memcpy (&ts, CMSG_DATA (cm), sizeof(ts));
+			return mq_clock_from_realtime (ts.ts[0].tv_sec * 1000000000LL + ts.ts[0].tv_nsec);
+		}
+	}
+	return 0;
+}
+
+static int tstamp_enable (int fd, int flags) {
+	if (setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+		mq_log_error ("Kernel timestamps cannot be enabled: %s", strerror (errno));
+		return -1;
+	}
+	return 0;
+}
+
+int mq_tstamp_enable_rx (int fd) {
+	return tstamp_enable (fd, SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE);
+}
+
+int mq_tstamp_enable_tx (int fd) {
+	return tstamp_enable (fd, SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+			SOF_TIMESTAMPING_OPT_TSONLY);
+}
+
+int64_t mq_tstamp_rx (int fd) {
+
+	char byte = 0;
+	char control[MQ_TSTAMP_CONTROL_LEN];
+	struct iovec iov = { &byte, 1 };
+	struct msghdr msg;
+
+	memset (&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg (fd, &msg, MSG_PEEK | MSG_DONTWAIT) <= 0) {
+		return 0;
+	}
+	return cmsg_tstamp (&msg);
+}
+
+int mq_tstamp_tx_collect (MqTxStamps* ts, int fd, MqHist* hist) {
+
+	char control[MQ_TSTAMP_CONTROL_LEN];
+	struct msghdr msg;
+	int64_t latest = 0;
+	int64_t stamp = 0;
+	int covered = 0;
+	int i = 0;
+
+	for (i = 0; i < MQ_TSTAMP_MAX_DRAIN; i++) {
+		memset (&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg (fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+		stamp = cmsg_tstamp (&msg);
+		if (stamp > latest) latest = stamp;
+	}
+	if (latest <= ts->last) {
+		return 0;
+	}
+	ts->last = latest;
+	for (; ts->tail != ts->head; ts->tail++) {
+		mq_hist_record (hist, latest - ts->txtime[ts->tail & (MQ_TSTAMP_PENDING - 1)]);
+		covered++;
+	}
+	ts->stamped += covered;
+	return covered;
+}
+
+#else
+
+int mq_tstamp_enable_rx (int fd) {
+	mq_log_error ("Kernel timestamps (SO_TIMESTAMPING) are only supported on linux");
+	return -1;
+}
+
+int mq_tstamp_enable_tx (int fd) {
+	return mq_tstamp_enable_rx (fd);
+}
+
+int64_t mq_tstamp_rx (int fd) {
+	return 0;
+}
+
+int mq_tstamp_tx_collect (MqTxStamps* ts, int fd, MqHist* hist) {
+	return 0;
+}
+
+#endif
+
+int64_t mq_tstamp_wait_rx (int fd, int writing, int timeout_msec) {
+
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN | (writing ? POLLOUT : 0);
+	pfd.revents = 0;
+	if (poll (&pfd, 1, timeout_msec) <= 0 || !(pfd.revents & POLLIN)) {
+		return 0;
+	}
+	return mq_tstamp_rx (fd);
+}
+
+void mq_tstamp_tx_init (MqTxStamps* ts) {
+	memset (ts, 0, sizeof(MqTxStamps));
+}
+
+void mq_tstamp_tx_sent (MqTxStamps* ts, int64_t txtime) {
+	if (ts->head - ts->tail == MQ_TSTAMP_PENDING) {
+		ts->tail++; // the oldest never got a stamp
+		ts->unstamped++;
+	}
+	ts->txtime[ts->head++ & (MQ_TSTAMP_PENDING - 1)] = txtime;
+}
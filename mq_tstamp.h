@@ -0,0 +1,80 @@
+/*
+ * mq_tstamp.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MQ_TSTAMP_H_
+#define MQ_TSTAMP_H_
+
+#include <stdint.h>
+
+#include "mq_hist.h"
+
+#define MQ_TSTAMP_PENDING 4096 // sent messages waiting for a kernel tx stamp, power of two
+
+/**
+ * kernel software timestamps (SO_TIMESTAMPING) of a client socket; linux only.
+ *
+ * libmosquitto reads and writes the socket itself, so the stamps are taken
+ * around it: the rx stamp is peeked before the library reads, and is the
+ * time the kernel received the oldest unread segment; tx stamps are drained
+ * from the error queue after the library writes. the kernel stamps are
+ * CLOCK_REALTIME; they are returned in the mq_clock source, in nsec since
+ * the epoch, so they compare w/ mq_clock_now whatever -k is.
+ */
+
+/**
+ * enables rx software timestamps on the socket. returns -1 on error or if
+ * the system has no SO_TIMESTAMPING
+ */
+int mq_tstamp_enable_rx (int fd);
+
+/**
+ * enables tx software timestamps on the socket. every write queues a stamp
+ * on the error queue, which keeps the socket in error until it is drained,
+ * so only for sockets mq_tstamp_tx_collect is called on. returns -1 on error
+ */
+int mq_tstamp_enable_tx (int fd);
+
+/**
+ * kernel rx time of the oldest unread byte of the socket; 0 if nothing is
+ * waiting to be read or it has no stamp
+ */
+int64_t mq_tstamp_rx (int fd);
+
+/**
+ * waits up to timeout_msec for the socket to become readable (or writable
+ * if writing) and returns the kernel rx time of the data waiting, as
+ * mq_tstamp_rx. for clients run w/ mosquitto_loop, which then need not wait
+ */
+int64_t mq_tstamp_wait_rx (int fd, int writing, int timeout_msec);
+
+/**
+ * messages sent and not yet matched w/ a kernel tx stamp
+ */
+typedef struct MqTxStamps {
+	int64_t txtime[MQ_TSTAMP_PENDING];
+	uint64_t head;
+	uint64_t tail;
+	int64_t last;       // latest kernel tx stamp
+	int64_t stamped;
+	int64_t unstamped;  // messages overwritten before they got a stamp
+} MqTxStamps;
+
+void mq_tstamp_tx_init (MqTxStamps* ts);
+
+/**
+ * a message stamped w/ txtime is queued to the library
+ */
+void mq_tstamp_tx_sent (MqTxStamps* ts, int64_t txtime);
+
+/**
+ * drains the tx stamps of the socket. a stamp newer than the last one covers
+ * every message sent so far, so call it only when the library has nothing
+ * left to write. kernel tx - txtime of every covered message is recorded in
+ * hist. returns the number of covered messages
+ */
+int mq_tstamp_tx_collect (MqTxStamps* ts, int fd, MqHist* hist);
+
+#endif /* MQ_TSTAMP_H_ */
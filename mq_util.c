@@ -6,8 +6,11 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <math.h>
+#include <string.h>
+#include <limits.h>
 
 #include <mosquitto.h>
 
@@ -34,55 +37,126 @@ long mq_util_timeval_diff_usec (struct timeval x, struct timeval y) {
 	dt.tv_sec = x.tv_sec - y.tv_sec;
 	dt.tv_usec = x.tv_usec - y.tv_usec;
 
-	return labs (dt.tv_sec * 1000000 + dt.tv_usec);
+	return dt.tv_sec * 1000000 + dt.tv_usec;
 }
 
 
-int mq_util_sleep_usecs_for_next_request (int freq, const struct timeval *previous_time) {
-
-  unsigned long waitTime_usec    = 0;
-  unsigned long prevReqTime_usec = 0;
-  unsigned long nextReqTime_usec = 0;
-  long sleepTime_usec            = 0;
-  struct timeval currentTime;
-
-  if(freq) {
-    waitTime_usec = 1000000.0 * (1.0/freq);
-
-    prevReqTime_usec = (previous_time->tv_sec)*1000000 +
-      previous_time->tv_usec;
-
-    nextReqTime_usec = prevReqTime_usec + waitTime_usec;
-
-    gettimeofday(&currentTime,0);
-
-    sleepTime_usec = nextReqTime_usec -
-      (currentTime.tv_sec*1000000 + currentTime.tv_usec);
-    /*
-     * printf("nextReqTime: %lu + %lu = %lu\n",
-     * prevReqTime_usec, waitTime_usec, nextReqTime_usec);
-     */
-    if(sleepTime_usec < 0) {
-      mq_log_error ("Schedule error %lu usec", labs(sleepTime_usec));
-      /*
-       * printf("nextReqTime: %lu\n",
-       * (unsigned long)(nextReqTime.tv_sec * 1000 +
-       *                 nextReqTime.tv_usec / 1000));
-       * printf("currentTime: %lu\n",
-       * (unsigned long)(currentTime.tv_sec * 1000 +
-       *                 currentTime.tv_usec / 1000));
-       */
-      return 0;
-    }
-  }
-  mq_log_debug ("Shall sleep %d usec", sleepTime_usec);
-  return sleepTime_usec;
+void mq_util_summary_init (MqSummary* s) {
+	s->count = 0;
+	s->min = LONG_MAX;
+	s->max = LONG_MIN;
+	s->abs_sum = 0.0;
 }
 
+void mq_util_summary_add (MqSummary* s, long value) {
+	if (value < s->min) s->min = value;
+	if (value > s->max) s->max = value;
+	s->abs_sum += labs(value);
+	s->count++;
+}
+
+double mq_util_summary_avg (const MqSummary* s) {
+	return s->count ? s->abs_sum / s->count : 0.0;
+}
+
+
+static int compare_samples (const void* a, const void* b) {
+	long x = *(const long*) a;
+	long y = *(const long*) b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void mq_util_sort_samples (long* samples, int count) {
+	qsort (samples, count, sizeof(long), compare_samples);
+}
+
+long mq_util_percentile (const long* sorted, int count, double p) {
+	int rank = 0;
+
+	if (count <= 0) return 0;
+
+	rank = (int) ceil (p / 100.0 * count) - 1;
+	if (rank < 0) rank = 0;
+	if (rank >= count) rank = count - 1;
+	return sorted[rank];
+}
+
+static const double mq_percentiles[MQ_UTIL_NUM_PERCENTILES] = {50.0, 90.0, 99.0, 99.9, 99.99};
+static const char* mq_percentile_names[MQ_UTIL_NUM_PERCENTILES] = {"p50", "p90", "p99", "p99.9", "p99.99"};
+
+#define NUM_PERCENTILES MQ_UTIL_NUM_PERCENTILES
+
+void mq_util_dump_latency (long* uncorrected, long* corrected, int count) {
+
+	MqLatency latency;
+
+	mq_util_latency_compute (&latency, uncorrected, corrected, count);
+	mq_util_latency_dump (&latency);
+}
+
+void mq_util_latency_compute (MqLatency* latency, long* uncorrected, long* corrected, int count) {
+
+	long* samples[2] = {uncorrected, corrected};
+	int i = 0;
+	int k = 0;
+
+	memset (latency, 0, sizeof(MqLatency));
+	latency->count = count;
+	if (count <= 0) return;
+
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < count; i++) {
+			latency->avg[k] += samples[k][i];
+		}
+		latency->avg[k] /= count;
+
+		mq_util_sort_samples (samples[k], count);
+
+		latency->min[k] = samples[k][0];
+		latency->max[k] = samples[k][count - 1];
+		for (i = 0; i < NUM_PERCENTILES; i++) {
+			latency->percentiles[k][i] = mq_util_percentile (samples[k], count, mq_percentiles[i]);
+		}
+	}
+}
 
+void mq_util_latency_from_hist (MqLatency* latency, const MqHist* uncorrected, const MqHist* corrected) {
 
+	const MqHist* hists[2] = {uncorrected, corrected};
+	int i = 0;
+	int k = 0;
 
+	memset (latency, 0, sizeof(MqLatency));
+	latency->count = (int) uncorrected->total;
+	latency->from_hist = 1;
+	if (latency->count <= 0) return;
 
+	for (k = 0; k < 2; k++) {
+		latency->min[k] = hists[k]->min;
+		latency->max[k] = hists[k]->max;
+		latency->avg[k] = mq_hist_mean (hists[k]);
+		for (i = 0; i < NUM_PERCENTILES; i++) {
+			latency->percentiles[k][i] = mq_hist_percentile (hists[k], mq_percentiles[i]);
+		}
+	}
+}
+
+void mq_util_latency_dump (const MqLatency* latency) {
+
+	int i = 0;
+
+	if (latency->count <= 0) return;
+
+	printf ("Latency (%d samples%s) uncorrected / corrected ----------\n", latency->count,
+			latency->from_hist ? ", histogram" : "");
+	printf ("min    %10ld %10ld usec\n", latency->min[0], latency->min[1]);
+	for (i = 0; i < NUM_PERCENTILES; i++) {
+		printf ("%-6s %10ld %10ld usec\n", mq_percentile_names[i],
+				latency->percentiles[0][i], latency->percentiles[1][i]);
+	}
+	printf ("max    %10ld %10ld usec\n", latency->max[0], latency->max[1]);
+	printf ("avg    %10.2f %10.2f usec\n", latency->avg[0], latency->avg[1]);
+}
 
 
 /**
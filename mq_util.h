@@ -10,9 +10,77 @@
 
 #include <sys/time.h>
 
+#include "mq_hist.h"
+
+/**
+ * min / max of a series of samples and the mean of their absolute values
+ */
+typedef struct MqSummary {
+	int count;
+	long min;
+	long max;
+	double abs_sum;
+} MqSummary;
+
+#define MQ_UTIL_NUM_PERCENTILES 5 // p50, p90, p99, p99.9, p99.99
+
+/**
+ * latency distribution from the actual txtime (0, uncorrected) and from the
+ * intended txtime (1, corrected for coordinated omission), usec
+ */
+typedef struct MqLatency {
+	int count;
+	long min[2];
+	long max[2];
+	long percentiles[2][MQ_UTIL_NUM_PERCENTILES];
+	double avg[2];
+	int from_hist;  // percentiles within the precision of a histogram, not of the samples
+} MqLatency;
+
+/**
+ * x - y in usec; negative if x is earlier than y
+ */
 long mq_util_timeval_diff_usec (struct timeval x, struct timeval y);
 
-int mq_util_sleep_usecs_for_next_request (int freq, const struct timeval* previous_time);
+void mq_util_summary_init (MqSummary* s);
+
+void mq_util_summary_add (MqSummary* s, long value);
+
+double mq_util_summary_avg (const MqSummary* s);
+
+/**
+ * sorts the samples in place
+ */
+void mq_util_sort_samples (long* samples, int count);
+
+/**
+ * p-th (0-100) percentile of the sorted samples, nearest rank
+ */
+long mq_util_percentile (const long* sorted, int count, double p);
+
+/**
+ * prints the latency distribution measured from the actual txtime (uncorrected) and
+ * from the intended txtime (corrected for coordinated omission) side by side.
+ * sorts the samples in place
+ */
+void mq_util_dump_latency (long* uncorrected, long* corrected, int count);
+
+/**
+ * fills latency from the samples, so that it can be computed on one thread
+ * and printed on another. sorts the samples in place
+ */
+void mq_util_latency_compute (MqLatency* latency, long* uncorrected, long* corrected, int count);
+
+/**
+ * fills latency from histograms of the uncorrected and corrected delays,
+ * when there are too many samples to keep
+ */
+void mq_util_latency_from_hist (MqLatency* latency, const MqHist* uncorrected, const MqHist* corrected);
+
+/**
+ * prints latency as mq_util_dump_latency does
+ */
+void mq_util_latency_dump (const MqLatency* latency);
 
 void mq_util_print_error (int result);
 
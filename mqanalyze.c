@@ -0,0 +1,270 @@
+/**
+ * mqanalyze -f <capture-file> -d <debuglevel> -H <precision-bits>
+ *           -i <report-interval> -j -b <from-secs> -e <to-secs>
+ *           -P <producer> -S <subscriber> -t <topic>
+ *
+ * recomputes the statistics of mqconsumer (or sqconsumer) -w from its capture
+ * file. the file is mapped read only, so runs of any length are analyzed in
+ * place w/ the memory of the histograms only.
+ *
+ * -b and -e slice the run by rx time, in seconds from its first message;
+ * -P, -S and -t keep only the messages of a producer, a subscriber or a topic.
+ * w/ -i the interval reports are printed as mqconsumer -i would have.
+ *
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mq_log.h"
+#include "mq_hist.h"
+#include "mq_report.h"
+#include "mq_capture.h"
+#include "mq_rxstats.h"
+
+#define MAX_FILE_NAME_LEN 1024
+#define MAX_TOPIC_NAME_LEN 1024
+
+typedef struct Args {
+	char capture_file[MAX_FILE_NAME_LEN];
+	int debug_level;
+	int hist_bits; // histogram precision
+	double report_secs; // 0: no interval reports
+	int report_json;
+	double from_secs;
+	double to_secs;  // 0: to the end
+	int64_t producer;   // -1: all
+	int64_t subscriber; // -1: all
+	char topic_name[MAX_TOPIC_NAME_LEN]; // empty: all
+} Args;
+
+static Args mq_args;
+
+static MqCapture mq_capture;
+
+static MqRxStats mq_rx_stats;
+
+/**
+ * print_usage
+ */
+static void print_usage () {
+	fprintf (stderr, "Usage: mqanalyze -f <capture-file>\n"
+			         "                 [-d <debuglevel> (0-3)]\n"
+			         "                 [-H <histogram-precision-bits> (7: < 1.6%% error)]\n"
+			         "                 [-i <report-interval-secs> (0: only at the end)]\n"
+			         "                 [-j (interval reports in JSON instead of CSV)]\n"
+			         "                 [-b <from-secs> (0, since the first message)]\n"
+			         "                 [-e <to-secs> (0: to the end)]\n"
+			         "                 [-P <producer> (all)]\n"
+			         "                 [-S <subscriber> (all)]\n"
+			         "                 [-t <topic> (all)]\n"
+		             "                 -? (prints out this usage)\n");
+}
+
+/**
+ * parse_args
+ */
+static int parse_args(int ac, char** av) {
+	int c = 0;
+
+	memset(mq_args.capture_file, 0, MAX_FILE_NAME_LEN);
+	mq_args.debug_level = MQ_LOG_ERROR; // error!
+	mq_args.hist_bits = MQ_HIST_DEFAULT_SUB_BITS;
+	mq_args.report_secs = 0.0;
+	mq_args.report_json = 0;
+	mq_args.from_secs = 0.0;
+	mq_args.to_secs = 0.0;
+	mq_args.producer = -1;
+	mq_args.subscriber = -1;
+	memset(mq_args.topic_name, 0, MAX_TOPIC_NAME_LEN);
+
+	while ((c = getopt(ac, av, "?f:d:H:i:jb:e:P:S:t:")) != -1) {
+		switch (c) {
+		case '?':
+			print_usage();
+			exit(EXIT_SUCCESS);
+			break;
+		case 'f':
+			strncpy (mq_args.capture_file, optarg, MAX_FILE_NAME_LEN - 1);
+			break;
+		case 'd':
+			mq_args.debug_level = atoi (optarg);
+			break;
+		case 'H':
+			mq_args.hist_bits = atoi (optarg);
+			break;
+		case 'i':
+			mq_args.report_secs = atof (optarg);
+			break;
+		case 'j':
+			mq_args.report_json = 1;
+			break;
+		case 'b':
+			mq_args.from_secs = atof (optarg);
+			break;
+		case 'e':
+			mq_args.to_secs = atof (optarg);
+			break;
+		case 'P':
+			mq_args.producer = strtoll (optarg, 0, 10);
+			break;
+		case 'S':
+			mq_args.subscriber = strtoll (optarg, 0, 10);
+			break;
+		case 't':
+			strncpy (mq_args.topic_name, optarg, MAX_TOPIC_NAME_LEN - 1);
+			break;
+
+		default:
+			mq_log_error ("'%c' %s",c, "unknown parameter!");
+			return -1;
+		};
+	}
+
+	if (strlen(mq_args.capture_file) == 0) {
+		mq_log_error("%s", "Capture file must be supplied!");
+		return -1;
+	}
+
+	if (mq_args.report_secs < 0) {
+		mq_log_error ("%s", "Report interval cannot be negative");
+		return -1;
+	}
+
+	if (mq_args.from_secs < 0 || mq_args.to_secs < 0 ||
+		(mq_args.to_secs > 0 && mq_args.to_secs <= mq_args.from_secs)) {
+		mq_log_error ("%s", "Time slice must be 0 <= from < to");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * prints what the capture file holds
+ */
+static void dump_capture (const MqCapture* cap, int64_t first, int64_t last) {
+
+	const MqCaptureHeader* hdr = cap->hdr;
+	int i = 0;
+
+	printf ("Capture -----------------------------------------------\n");
+	printf ("%s: %" PRIu64 " messages by %s, %s clock, %.3f secs\n", mq_args.capture_file,
+			hdr->count, hdr->source, hdr->clock, (last - first) / 1000000000.0);
+	if (hdr->dropped > 0) {
+		printf ("%" PRId64 " messages did not fit into the file\n", hdr->dropped);
+	}
+	for (i = 0; i < (int) hdr->num_topics; i++) {
+		printf ("topic %3d '%s'\n", i, hdr->topics[i]);
+	}
+}
+
+/**
+ * main
+ */
+int main (int ac, char** av) {
+
+	char* bname = 0;
+	const MqCaptureRecord* rec = 0;
+	const char* topic = 0;
+	int64_t first = 0;
+	int64_t last = 0;
+	int64_t from = 0;
+	int64_t to = 0;
+	int64_t matched = 0;
+	int topic_index = -1;
+	uint64_t i = 0;
+	int result = EXIT_SUCCESS;
+
+	bname = strdup (basename(av[0]));
+
+	// log needs to be initialized for parse_args and print_usage!
+	mq_log_init (bname, MQ_LOG_ERROR);
+
+	if (parse_args (ac, av) == -1) {
+		print_usage ();
+		exit(EXIT_FAILURE);
+		// does not reach here!
+	}
+	// re-set log level
+	mq_log_set_debug_level (mq_args.debug_level);
+
+	if (mq_capture_open (&mq_capture, mq_args.capture_file) == -1) {
+		exit (EXIT_FAILURE);
+	}
+	if (mq_capture.count == 0) {
+		mq_log_error ("No messages in '%s'", mq_args.capture_file);
+		result = EXIT_FAILURE;
+		goto cleanup;
+	}
+	if (mq_args.topic_name[0]) {
+		for (topic_index = 0; topic_index < (int) mq_capture.hdr->num_topics; topic_index++) {
+			if (strcmp (mq_capture_topic_name (&mq_capture, topic_index), mq_args.topic_name) == 0) break;
+		}
+		if (topic_index == (int) mq_capture.hdr->num_topics) {
+			mq_log_error ("No messages on '%s' in '%s'", mq_args.topic_name, mq_args.capture_file);
+			result = EXIT_FAILURE;
+			goto cleanup;
+		}
+	}
+
+	// records are in the order they were counted, rx times of different subscribers interleave
+	first = mq_capture.records[0].rxtime;
+	last = first;
+	for (i = 0; i < mq_capture.count; i++) {
+		if (mq_capture.records[i].rxtime < first) first = mq_capture.records[i].rxtime;
+		if (mq_capture.records[i].rxtime > last) last = mq_capture.records[i].rxtime;
+	}
+	from = first + (int64_t) (mq_args.from_secs * 1000000000.0);
+	to = mq_args.to_secs > 0 ? first + (int64_t) (mq_args.to_secs * 1000000000.0) : last + 1;
+
+	if (mq_rxstats_init (&mq_rx_stats, mq_args.hist_bits,
+			mq_args.topic_name[0] ? mq_args.topic_name : mq_capture.hdr->topics[0], mq_args.report_secs,
+			mq_args.report_json ? MQ_REPORT_JSON : MQ_REPORT_CSV) == -1) {
+		result = EXIT_FAILURE;
+		goto cleanup;
+	}
+	mq_rx_stats.subscriber = mq_args.subscriber >= 0 ? (uint32_t) mq_args.subscriber : 0;
+
+	if (mq_args.report_secs > 0) {
+		mq_report_header (mq_args.report_json ? MQ_REPORT_JSON : MQ_REPORT_CSV, "delay", "jitter");
+	}
+	mq_report_start (&mq_rx_stats.report, from);
+
+	for (i = 0; i < mq_capture.count; i++) {
+		rec = mq_capture.records + i;
+		if (rec->rxtime < from || rec->rxtime >= to) continue;
+		if (mq_args.producer >= 0 && rec->producer != (uint32_t) mq_args.producer) continue;
+		if (mq_args.subscriber >= 0 && rec->subscriber != (uint32_t) mq_args.subscriber) continue;
+		if (topic_index >= 0 && rec->topic != topic_index) continue;
+
+		topic = rec->topic < MQ_CAPTURE_MAX_TOPICS ? mq_capture_topic_name (&mq_capture, rec->topic) : "(other)";
+		mq_rxstats_add (&mq_rx_stats, topic, rec);
+		if (mq_report_due (&mq_rx_stats.report, rec->rxtime)) {
+			mq_report_emit (&mq_rx_stats.report, rec->rxtime, mq_stream_table_lost (&mq_rx_stats.streams));
+		}
+		matched++;
+	}
+	if (mq_args.report_secs > 0 && matched > 0) {
+		// the last, partial interval
+		mq_report_emit (&mq_rx_stats.report, to < last ? to : last, mq_stream_table_lost (&mq_rx_stats.streams));
+	}
+
+	dump_capture (&mq_capture, first, last);
+	mq_rxstats_dump (&mq_rx_stats);
+	mq_rxstats_destroy (&mq_rx_stats);
+
+	/* CLEANUP LABEL*/
+	cleanup:
+
+	mq_capture_close (&mq_capture);
+	mq_log_destroy();
+	free (bname);
+
+	return result;
+}
@@ -2,6 +2,42 @@
  * $Id: mqconsumer.c 169 2012-02-21 10:07:29Z tufan $
  *
  * mqconsumer -t <topicname> -q <qos> -d <debuglevel> -h <host> -p <port>
+ *            -r <reply-topic-prefix> -o <control-topic> -O <resync-interval>
+ *            -k <clock> -H <precision-bits> -i <report-interval> -j
+ *            -c <num-subscribers> -T <mux-threads> -w <capture-file> -W <capture-records> -K
+ *
+ * w/ -r every received message is republished as is on '<reply-topic-prefix>/<topic>'
+ * so that the producer can measure the round trip time w/ its own clock.
+ *
+ * w/ -o the offset of the producer's clock (mqproducer -o) is estimated over
+ * '<control-topic>' at start and every <resync-interval> seconds, and every
+ * delay sample is corrected w/ it.
+ *
+ * statistics are kept in log-linear histograms, so memory does not grow w/
+ * the length of the run. -H sets their precision.
+ *
+ * w/ -i a CSV (or w/ -j JSON) line is printed every <report-interval> seconds:
+ * messages and bytes per second, messages lost, delay and RFC 3550 transit
+ * variation (|D|) percentiles of the interval.
+ *
+ * the network thread only stamps every message (and echoes it, and checks
+ * its crc w/ -C) and pushes a fixed size record into a lock-free ring; the
+ * statistics are computed on a thread of their own, so they neither slow
+ * down nor delay the receive path.
+ *
+ * w/ -c the topic is subscribed by <num-subscribers> clients in this process,
+ * to reproduce a broker's fan-out. the first one is driven by mosquitto_loop
+ * as always (it echoes, synchronizes the clock and ends the run); the others
+ * are multiplexed over -T threads, each waiting for the readiness of its
+ * clients' sockets w/ epoll. every thread hands its records over through a
+ * ring of its own, and streams are kept per producer and subscriber.
+ *
+ * w/ -K the kernel rx time of every message is taken too (SO_TIMESTAMPING),
+ * splitting the delay into the time until the kernel received the message
+ * and the time the consumer's stack took to deliver it.
+ *
+ * w/ -w every message is also appended to a memory mapped capture file of
+ * fixed size records, which mqanalyze reads back to recompute the reports.
  *
  */
 
@@ -13,17 +49,32 @@
 #include <libgen.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <mosquitto.h>
 
 #include "mq_log.h"
 #include "mq_util.h"
 #include "mq_message.h"
+#include "mq_clocksync.h"
+#include "mq_clock.h"
+#include "mq_hist.h"
+#include "mq_stream.h"
+#include "mq_report.h"
+#include "mq_ring.h"
+#include "mq_mux.h"
+#include "mq_capture.h"
+#include "mq_rxstats.h"
+#include "mq_tstamp.h"
+#include "mq_topic.h"
 
 
 #define MAX_TOPIC_NAME_LEN 1024  // seems big enough
 #define MAX_HOST_NAME_LEN 256
-#define MAX_NUM_OF_STATS 10000 // max number of samples
+#define MAX_CLOCK_NAME_LEN 16
+#define MAX_FILE_NAME_LEN 1024
 
 #ifdef MOSQ_DEBUG
   #define MOSQ_LOG_LEVEL  (MOSQ_LOG_DEBUG | MOSQ_LOG_ERR | MOSQ_LOG_WARNING | \
@@ -39,37 +90,94 @@
 
 #define MOSQ_KEEPALIVE_TIMEOUT 10 // seconds
 
+#define MOSQ_DEFAULT_RESYNC_SECS 10
+
+#define MOSQ_RX_RING_SIZE 65536 // records between the network and the stats thread
+#define MOSQ_RX_IDLE_USEC 100   // stats thread sleep when the ring is empty
+#define MOSQ_RX_BATCH 256       // records taken from a ring before moving to the next one
+#define MOSQ_RX_TOPIC_LEN MQ_CAPTURE_TOPIC_LEN // longer topics are cut, as in a capture
+#define MOSQ_MAX_SUBSCRIBERS 100000
+#define MOSQ_SPARE_FDS 64       // open files besides the subscribers' sockets
+
 typedef struct Args {
 	char topic_name[MAX_TOPIC_NAME_LEN];
 	char host_name[MAX_HOST_NAME_LEN];
 	int port;
 	int qos;
 	int debug_level;
+	char reply_topic[MAX_TOPIC_NAME_LEN]; // echo prefix, empty if not echoing
+	char control_topic[MAX_TOPIC_NAME_LEN]; // clock sync, empty if not correcting
+	int resync_secs; // 0: estimate once at start
+	char clock[MAX_CLOCK_NAME_LEN];
+	int hist_bits; // histogram precision
+	double report_secs; // 0: no interval reports
+	int report_json;
+	int num_subscribers; // clients subscribing to the topic
+	int mux_threads;     // threads driving the subscribers other than the first
+	char capture_file[MAX_FILE_NAME_LEN]; // empty if not capturing
+	uint64_t capture_records;
+	int kernel_tstamps; // SO_TIMESTAMPING rx stamps
 } Args;
 
-typedef struct JitterStat {
-	int from;
-	int to;
-	long rx_usec_from_to;
-	long tx_usec_from_to;
-} JitterStat;
+/**
+ * what the network thread hands over to the stats thread for every message
+ */
+typedef struct RxRecord {
+	MqCaptureRecord sample; // subscriber is the client that received it, 0 w/o -c
+	char topic[MOSQ_RX_TOPIC_LEN]; // copied, interned by the stats thread
+} RxRecord;
 
 /**
- * this is not very reliable when producer and consumer resides on different machines.
- * even both machines are synchronized w/ NTP
+ * what a network thread owns: the ring to the stats thread and the integrity
+ * counters of its messages
  */
-typedef struct DelayStat {
-	int mid;
-	long usec_tx_delay;
-} DelayStat;
+typedef struct RxSource {
+	MqRing ring;
+	MqMessageCheck check;
+	int64_t overruns; // records dropped by the network thread, the ring was full
+} RxSource;
 
-void dump_delay_stats();
-void dump_jitter_stats();
+/**
+ * stats thread; drains the rx rings into mq_rx_stats and prints the interval
+ * reports. source 0 is the main thread, source i the multiplexer thread i - 1
+ */
+typedef struct StatsThread {
+	RxSource* sources;
+	int num_sources;
+	MqTopicTable topics; // of the records, owned by the stats thread
+	pthread_t thread;
+	int running;
+	int stop;
+} StatsThread;
+
+/**
+ * a subscriber driven by the multiplexer
+ */
+typedef struct Subscriber {
+	struct mosquitto* mosq;
+	uint32_t id;
+	RxSource* source;
+	const int64_t* kernel_rxtime; // of its shard
+} Subscriber;
+
+void dump_rx_stats();
 
 static Args mq_args;
 
-static JitterStat* mq_jitter_stats = 0;
-static DelayStat*  mq_delay_stats = 0;
+static MqRxStats mq_rx_stats;
+
+static MqCapture mq_capture; // written by the stats thread
+
+static StatsThread mq_stats_thread;
+
+static MqMux mq_mux;
+static Subscriber* mq_subscribers = 0; // 1 .. num_subscribers - 1
+
+static MqClockSync mq_clocksync;
+static int64_t mq_clock_offset_usec = 0; // published by the main thread for the multiplexer threads
+static int64_t mq_kernel_rxtime = 0; // of the data the main loop is about to read, w/ -K
+
+static char mq_clocksync_reply_topic[2 * MAX_TOPIC_NAME_LEN];
 
 /**
  * print_usage
@@ -80,6 +188,18 @@ static void print_usage () {
 			         "                  [-d <debuglevel> (0-3)]\n"
 			         "                  [-h <broker-host> (localhost)]\n"
 			         "                  [-p <broker-port> (1883)]\n"
+			         "                  [-r <reply-topic-prefix> (echo messages to '<prefix>/<topic>')]\n"
+			         "                  [-o <control-topic> (estimate the clock offset of mqproducer -o)]\n"
+			         "                  [-O <resync-interval-secs> (10, 0: once at start)]\n"
+			         "                  [-k <clock> (realtime | monotonic | tsc)]\n"
+			         "                  [-H <histogram-precision-bits> (7: < 1.6%% error)]\n"
+			         "                  [-i <report-interval-secs> (0: only at the end)]\n"
+			         "                  [-j (interval reports in JSON instead of CSV)]\n"
+			         "                  [-c <num-subscribers> (1)]\n"
+			         "                  [-T <mux-threads> (1, drive subscribers 2..n)]\n"
+			         "                  [-w <capture-file> (append every message, see mqanalyze)]\n"
+			         "                  [-W <capture-records> (16777216, the file is allocated up front)]\n"
+			         "                  [-K (kernel rx timestamps, time spent in the consumer's stack)]\n"
 		             "                  -? (prints out this usage)\n");
 }
 
@@ -94,8 +214,20 @@ static int parse_args(int ac, char** av) {
 	mq_args.debug_level = MQ_LOG_ERROR; // error!
 	strncpy (mq_args.host_name, MOSQ_DEFAULT_HOST, MAX_HOST_NAME_LEN);
 	mq_args.port = MOSQ_DEFAULT_PORT;
-
-	while ((c = getopt(ac, av, "?t:q:d:h:p:")) != -1) {
+	memset(mq_args.reply_topic, 0, MAX_TOPIC_NAME_LEN);
+	memset(mq_args.control_topic, 0, MAX_TOPIC_NAME_LEN);
+	mq_args.resync_secs = MOSQ_DEFAULT_RESYNC_SECS;
+	strncpy (mq_args.clock, MQ_CLOCK_DEFAULT_SOURCE, MAX_CLOCK_NAME_LEN);
+	mq_args.hist_bits = MQ_HIST_DEFAULT_SUB_BITS;
+	mq_args.report_secs = 0.0;
+	mq_args.report_json = 0;
+	mq_args.num_subscribers = 1;
+	mq_args.mux_threads = 1;
+	memset(mq_args.capture_file, 0, MAX_FILE_NAME_LEN);
+	mq_args.capture_records = MQ_CAPTURE_DEFAULT_RECORDS;
+	mq_args.kernel_tstamps = 0;
+
+	while ((c = getopt(ac, av, "?t:q:d:h:p:r:o:O:k:H:i:jc:T:w:W:K")) != -1) {
 		switch (c) {
 		case '?':
 			print_usage();
@@ -116,6 +248,42 @@ static int parse_args(int ac, char** av) {
 		case 'p':
 			mq_args.port = atoi (optarg);
 			break;
+		case 'r':
+			strncpy (mq_args.reply_topic, optarg, MAX_TOPIC_NAME_LEN - 1);
+			break;
+		case 'o':
+			strncpy (mq_args.control_topic, optarg, MAX_TOPIC_NAME_LEN - 1);
+			break;
+		case 'O':
+			mq_args.resync_secs = atoi (optarg);
+			break;
+		case 'k':
+			strncpy (mq_args.clock, optarg, MAX_CLOCK_NAME_LEN - 1);
+			break;
+		case 'H':
+			mq_args.hist_bits = atoi (optarg);
+			break;
+		case 'i':
+			mq_args.report_secs = atof (optarg);
+			break;
+		case 'j':
+			mq_args.report_json = 1;
+			break;
+		case 'c':
+			mq_args.num_subscribers = atoi (optarg);
+			break;
+		case 'T':
+			mq_args.mux_threads = atoi (optarg);
+			break;
+		case 'w':
+			strncpy (mq_args.capture_file, optarg, MAX_FILE_NAME_LEN - 1);
+			break;
+		case 'W':
+			mq_args.capture_records = strtoull (optarg, 0, 10);
+			break;
+		case 'K':
+			mq_args.kernel_tstamps = 1;
+			break;
 
 		default:
 			mq_log_error ("'%c' %s",c, "unknown parameter!");
@@ -133,36 +301,191 @@ static int parse_args(int ac, char** av) {
 		return -1;
 	}
 
+	if (mq_args.resync_secs < 0) {
+		mq_log_error ("%s", "Resync interval cannot be negative");
+		return -1;
+	}
+
+	if (mq_args.report_secs < 0) {
+		mq_log_error ("%s", "Report interval cannot be negative");
+		return -1;
+	}
+
+	if (mq_args.num_subscribers < 1 || mq_args.num_subscribers > MOSQ_MAX_SUBSCRIBERS) {
+		mq_log_error ("Number of subscribers must be 1-%d", MOSQ_MAX_SUBSCRIBERS);
+		return -1;
+	}
+
+	if (mq_args.mux_threads < 1 || mq_args.mux_threads > MQ_MUX_MAX_SHARDS) {
+		mq_log_error ("Number of multiplexer threads must be 1-%d", MQ_MUX_MAX_SHARDS);
+		return -1;
+	}
+	if (mq_args.mux_threads > mq_args.num_subscribers - 1) {
+		mq_args.mux_threads = mq_args.num_subscribers > 1 ? mq_args.num_subscribers - 1 : 1;
+	}
+
+	if (mq_clock_init (mq_args.clock) == -1) {
+		return -1;
+	}
+
 	mq_log_debug ("'%s', %d, %d", mq_args.topic_name, mq_args.qos, mq_args.debug_level);
 	return 0;
 }
 
 
+/**
+ * stamps a received message and hands it over to the stats thread; returns
+ * -1 if it is not a valid message
+ */
+static int rx_source_push (RxSource* src, uint32_t subscriber, const struct mosquitto_message* msg,
+		int64_t now, int64_t offset_usec, int64_t kernel_rxtime) {
+
+	const MqMessageHeader* hdr = mq_message_header (msg->payload, msg->payloadlen);
+	RxRecord rec;
+
+	if (hdr == 0) {
+		mq_log_warning ("Ignoring unknown message (%d bytes)", msg->payloadlen);
+		return -1;
+	}
+	if (mq_message_check (&src->check, hdr, msg->payloadlen) == -1) {
+		mq_log_warning ("Ignoring corrupt message %" PRIu64 " on '%s'", mq_message_seq (hdr), msg->topic);
+		return -1;
+	}
+	mq_capture_record_set (&rec.sample, hdr, subscriber, msg->payloadlen, now, now + 1000 * offset_usec);
+	rec.sample.kernel_rxtime = kernel_rxtime;
+	strncpy (rec.topic, msg->topic, MOSQ_RX_TOPIC_LEN - 1);
+	rec.topic[MOSQ_RX_TOPIC_LEN - 1] = 0;
+	if (mq_ring_push (&src->ring, &rec) == -1) {
+		src->overruns++;
+	}
+	return 0;
+}
+
+static void* stats_thread_run (void* arg) {
+
+	StatsThread* t = (StatsThread*) arg;
+	MqRxStats* st = &mq_rx_stats;
+	int capture = mq_capture.hdr != 0;
+	struct timespec idle = {0, MOSQ_RX_IDLE_USEC * 1000};
+	RxRecord rec;
+	const char* topic = 0;
+	int64_t now = 0;
+	int stop = 0;
+	int popped = 0;
+	int i = 0;
+	int n = 0;
+
+	for (;;) {
+		// stop is set after the last push, so the rings are drained when it is seen
+		stop = __atomic_load_n (&t->stop, __ATOMIC_ACQUIRE);
+		popped = 0;
+		for (i = 0; i < t->num_sources; i++) {
+			// a batch at a time, so that a busy ring does not starve the others
+			for (n = 0; n < MOSQ_RX_BATCH && mq_ring_pop (&t->sources[i].ring, &rec) == 0; n++) {
+				topic = mq_topic_intern (&t->topics, rec.topic);
+				mq_rxstats_add (st, topic, &rec.sample);
+				if (capture) {
+					rec.sample.topic = mq_capture_topic (&mq_capture, topic);
+					mq_capture_append (&mq_capture, &rec.sample);
+				}
+				if (mq_report_due (&st->report, rec.sample.rxtime)) {
+					mq_report_emit (&st->report, rec.sample.rxtime, mq_stream_table_lost (&st->streams));
+				}
+			}
+			popped += n;
+		}
+		if (popped > 0) continue;
+		if (stop) break;
+
+		now = mq_clock_now ();
+		if (mq_report_due (&st->report, now)) {
+			mq_report_emit (&st->report, now, mq_stream_table_lost (&st->streams));
+		}
+		nanosleep (&idle, 0);
+	}
+	return 0;
+}
+
+static int stats_thread_start (StatsThread* t, int num_sources) {
+
+	int i = 0;
+
+	t->sources = (RxSource*) calloc (num_sources, sizeof(RxSource));
+	if (!t->sources) {
+		mq_log_error ("Memory for rx rings cannot be allocated!");
+		return -1;
+	}
+	t->num_sources = num_sources;
+	for (i = 0; i < num_sources; i++) {
+		if (mq_ring_init (&t->sources[i].ring, MOSQ_RX_RING_SIZE, sizeof(RxRecord)) == -1) {
+			return -1;
+		}
+	}
+	if (pthread_create (&t->thread, 0, stats_thread_run, t) != 0) {
+		mq_log_error ("Stats thread cannot be created!");
+		return -1;
+	}
+	t->running = 1;
+	return 0;
+}
+
+/**
+ * waits until the stats thread consumes what is left in the ring
+ */
+static void stats_thread_stop (StatsThread* t) {
+	if (!t->running) return;
+	__atomic_store_n (&t->stop, 1, __ATOMIC_RELEASE);
+	pthread_join (t->thread, 0);
+	t->running = 0;
+}
+
+static void stats_thread_destroy (StatsThread* t) {
+
+	int i = 0;
+
+	if (!t->sources) return;
+	for (i = 0; i < t->num_sources; i++) {
+		mq_ring_destroy (&t->sources[i].ring);
+	}
+	free (t->sources);
+	t->sources = 0;
+	mq_topic_table_destroy (&t->topics);
+}
+
+/**
+ * integrity counters and overruns of all the network threads
+ */
+static void stats_thread_dump (const StatsThread* t) {
+
+	MqMessageCheck check;
+	int64_t overruns = 0;
+	int i = 0;
+
+	memset (&check, 0, sizeof(MqMessageCheck));
+	for (i = 0; i < t->num_sources; i++) {
+		check.checked += t->sources[i].check.checked;
+		check.corrupt += t->sources[i].check.corrupt;
+		check.bytes += t->sources[i].check.bytes;
+		check.nsec += t->sources[i].check.nsec;
+		overruns += t->sources[i].overruns;
+	}
+	if (overruns > 0) {
+		printf ("%lld messages dropped, rx ring (%d) full\n", (long long) overruns, MOSQ_RX_RING_SIZE);
+	}
+	mq_message_check_dump (&check);
+}
+
+
 /**
  * mq_connect_callback
  */
 static void mq_connect_callback(void *obj, int result) {
 
-	void* p = 0;
-	void* q = 0;
-
 	if(!result){
 		mq_log_info ("Connected!\n");
 	}else{
 		mq_util_print_error (result);
 	}
-	p = malloc (MAX_NUM_OF_STATS * sizeof(JitterStat));
-	q = malloc (MAX_NUM_OF_STATS * sizeof(DelayStat));
-	if (p && q) {
-		memset (p, 0, MAX_NUM_OF_STATS * sizeof(JitterStat));
-		mq_jitter_stats = (JitterStat*) p;
-
-		memset (q, 0, MAX_NUM_OF_STATS * sizeof(DelayStat));
-		mq_delay_stats = (DelayStat*) q;
-
-	} else {
-		mq_log_error ("Memory for statistical data cannot be allocated!");
-	}
 }
 
 
@@ -173,9 +496,36 @@ static void mq_disconnect_callback(void *obj) {
 
 	mq_log_debug ("mq_disconnect_callback");
 
-	dump_jitter_stats();
-	printf ("\n\n");
-	dump_delay_stats();
+	// the subscribers push records too
+	mq_mux_stop (&mq_mux);
+	stats_thread_stop (&mq_stats_thread);
+	if (mq_rx_stats.report.interval_nsec > 0) {
+		// the last, partial interval
+		mq_report_emit (&mq_rx_stats.report, mq_clock_now (), mq_stream_table_lost (&mq_rx_stats.streams));
+	}
+	dump_rx_stats();
+	if (mq_args.control_topic[0]) {
+		mq_clocksync_dump (&mq_clocksync);
+	}
+	if (mq_args.num_subscribers > 1) {
+		mq_mux_dump (&mq_mux);
+	}
+	stats_thread_dump (&mq_stats_thread);
+	if (mq_capture.hdr) {
+		printf ("%llu messages captured to '%s'", (unsigned long long) mq_capture.count, mq_args.capture_file);
+		if (mq_capture.dropped > 0) {
+			printf (", %lld did not fit", (long long) mq_capture.dropped);
+		}
+		printf ("\n");
+	}
+	mq_clock_dump ();
+}
+
+/**
+ * the subscribers on the multiplexer end w/ the first one
+ */
+static void mq_subscriber_disconnect_callback(void *obj) {
+	mq_log_debug ("mq_subscriber_disconnect_callback for %u", ((Subscriber*) obj)->id);
 }
 
 
@@ -200,144 +550,127 @@ static void mq_unsubscribe_callback(void *obj, uint16_t mid) {
 
 static void mq_on_message_callback(void *obj, const struct mosquitto_message* msg) {
 
-	static int message_count = 0;
-	static struct mosquitto_message previous_message;
-	static struct timeval previous_msg_rx_tv = {0,0};
-
-	struct timeval now = {0,0};
-	double rx_dt_usec = 0.0;
-	double tx_dt_usec = 0.0;
-	JitterStat* jit_s = mq_jitter_stats;
-	DelayStat* dly_s = mq_delay_stats;
+	int64_t now = 0;
+	int64_t offset_usec = 0;
 
 	struct mosquitto* mosq = (struct mosquitto*) obj;
+	char reply_topic[2 * MAX_TOPIC_NAME_LEN];
+	int result = MOSQ_ERR_SUCCESS;
 
 	mq_log_debug ("mq_on_message_callback");
 
-	gettimeofday (&now, 0); // current message rx time
+	now = mq_clock_now (); // current message rx time
+
+	if (mq_args.control_topic[0] && strcmp (msg->topic, mq_clocksync_reply_topic) == 0) {
+		mq_clocksync_answer (&mq_clocksync, (const char*) msg->payload, msg->payloadlen, now / 1000);
+		return;
+	}
+	if (mq_args.control_topic[0] && strncmp (msg->topic, mq_args.control_topic, strlen (mq_args.control_topic)) == 0 &&
+		msg->topic[strlen (mq_args.control_topic)] == '/') {
+		return; // control traffic of others matched by a wildcard subscription
+	}
+	if (mq_args.reply_topic[0] && strncmp (msg->topic, mq_args.reply_topic, strlen (mq_args.reply_topic)) == 0 &&
+		msg->topic[strlen (mq_args.reply_topic)] == '/') {
+		return; // an echo matched by a wildcard subscription, echoing it would loop
+	}
+
+	if (mq_args.reply_topic[0] && msg->payloadlen > 0) {
+		// echo first, statistics must not add to the round trip
+		snprintf (reply_topic, sizeof(reply_topic), "%s/%s", mq_args.reply_topic, msg->topic);
+		result = mosquitto_publish (mosq, 0, reply_topic, msg->payloadlen, msg->payload, mq_args.qos, 0);
+		if (result != MOSQ_ERR_SUCCESS) {
+			mq_util_print_error (result);
+		}
+	}
 
 	if (msg->payloadlen == 0) {
 		// this is  a disconnect message!
 		mq_log_info ("Got ZERO payload message! Disconnecting!");
 		mosquitto_disconnect(mosq);
 	} else {
-		dly_s += message_count;
-		dly_s->mid = mq_message_id ((byte*)msg->payload);
-		dly_s->usec_tx_delay = mq_util_timeval_diff_usec(now, mq_message_txtime((byte*)msg->payload));
-
-		/* determine jitter */
-		if (message_count > 0) {
-			/**
-			 * Take the difference of two packet tx/rx timestamps.
-			 * Since packet production rate is constant during a test session,
-			 * the difference of two consecutive packet timestamps gives us a relative delay,
-			 * including packet production rate.
-			 * Later we will use these relative delays to calculate the delay variations
-			 * by simply calculating their difference.
-			 * If everything were perfect, then (relative) delay variation (jitter) would be 0.
-			 */
-
-			rx_dt_usec = mq_util_timeval_diff_usec (now, previous_msg_rx_tv);
-			tx_dt_usec = mq_util_timeval_diff_usec (mq_message_txtime((byte*)msg->payload),
-													mq_message_txtime((byte*)previous_message.payload));
-			jit_s += (message_count - 1);
-			jit_s->from = mq_message_id ((byte*)previous_message.payload);
-			jit_s->to = mq_message_id ((byte*)msg->payload);
-			jit_s->rx_usec_from_to = rx_dt_usec;
-			jit_s->tx_usec_from_to = tx_dt_usec;
-		}
-		mosquitto_message_copy(&previous_message, msg);
-		previous_msg_rx_tv = mq_message_txtime((byte*)msg->payload);
-		message_count++;
+		offset_usec = mq_clocksync_offset (&mq_clocksync, now / 1000);
+		__atomic_store_n (&mq_clock_offset_usec, offset_usec, __ATOMIC_RELAXED);
+		rx_source_push (&mq_stats_thread.sources[0], 0, msg, now, offset_usec, mq_kernel_rxtime);
 	}
 }
 
+/**
+ * runs on a multiplexer thread; neither echoes nor ends the run
+ */
+static void mq_subscriber_message_callback(void *obj, const struct mosquitto_message* msg) {
 
-void dump_jitter_stats() {
-
-	JitterStat* jit_s = 0;
-	int index = 0;
-
-	long tx_jitter = 0L;
-	long rx_jitter = 0L;
-
-	long rx_min = LONG_MAX;
-	long rx_max = LONG_MIN;
-	double rx_avg = 0.0;
-
-	long tx_min = LONG_MAX;
-	long tx_max = LONG_MIN;
-	double tx_avg = 0.0;
-
-	// dump stats
-	if (mq_jitter_stats) {
-		while ( (jit_s = (mq_jitter_stats + index)) != 0) {
-
-			if (jit_s->from == 0) break;
-
-			printf ("%4d %4d %6ld %6ld",
-					jit_s->from, jit_s->to,
-					jit_s->tx_usec_from_to, jit_s->rx_usec_from_to);
-
-			if (index) {
-				tx_jitter = (jit_s - 1)->tx_usec_from_to - jit_s->tx_usec_from_to;
-				rx_jitter = (jit_s - 1)->rx_usec_from_to - jit_s->rx_usec_from_to;
-
-				printf (" %6ld",      tx_jitter);
-				printf (" %6ld usec", rx_jitter);
+	Subscriber* sub = (Subscriber*) obj;
+	int64_t now = mq_clock_now ();
 
-				if (rx_jitter < rx_min) rx_min = rx_jitter;
-				if (rx_jitter > rx_max) rx_max = rx_jitter;
+	if (msg->payloadlen == 0) {
+		return;
+	}
+	if (mq_args.control_topic[0] && strncmp (msg->topic, mq_args.control_topic, strlen (mq_args.control_topic)) == 0 &&
+		msg->topic[strlen (mq_args.control_topic)] == '/') {
+		return;
+	}
+	rx_source_push (sub->source, sub->id, msg, now, __atomic_load_n (&mq_clock_offset_usec, __ATOMIC_RELAXED),
+			*sub->kernel_rxtime);
+}
 
-				if (tx_jitter < tx_min) tx_min = tx_jitter;
-				if (tx_jitter > tx_max) tx_max = tx_jitter;
+/**
+ * connects and subscribes the clients 1 .. num_subscribers - 1 and spreads
+ * them over the multiplexer threads
+ */
+static int start_subscribers (const char* client_id) {
 
-				tx_avg += labs(tx_jitter);
-				rx_avg += labs(rx_jitter);
+	char id[MAX_HOST_NAME_LEN];
+	Subscriber* sub = 0;
+	int shard = 0;
+	int result = MOSQ_ERR_SUCCESS;
+	int i = 0;
 
-			}
-      printf("\n");
-			index++;
+	if (mq_mux_reserve_fds (mq_args.num_subscribers + MOSQ_SPARE_FDS) == -1 ||
+		mq_mux_init (&mq_mux, mq_args.mux_threads) == -1) {
+		return -1;
+	}
+	mq_mux.kernel_tstamps = mq_args.kernel_tstamps;
+	mq_subscribers = (Subscriber*) calloc (mq_args.num_subscribers, sizeof(Subscriber));
+	if (!mq_subscribers) {
+		mq_log_error ("Memory for subscribers cannot be allocated!");
+		return -1;
+	}
+	for (i = 1; i < mq_args.num_subscribers; i++) {
+		sub = mq_subscribers + i;
+		shard = (i - 1) % mq_args.mux_threads;
+		sub->id = i;
+		sub->source = &mq_stats_thread.sources[1 + shard];
+		sub->kernel_rxtime = &mq_mux.shards[shard].kernel_rxtime;
+		snprintf (id, sizeof(id), "%s_%d", client_id, i);
+		sub->mosq = mosquitto_new (id, sub);
+		if (!sub->mosq) {
+			mq_log_error ("Error creating mosquito instance %d!", i);
+			return -1;
+		}
+		mosquitto_log_init (sub->mosq, MOSQ_LOG_LEVEL, MOSQ_LOG_STDERR);
+		mosquitto_connect_callback_set (sub->mosq, mq_connect_callback);
+		mosquitto_disconnect_callback_set (sub->mosq, mq_subscriber_disconnect_callback);
+		mosquitto_message_callback_set (sub->mosq, mq_subscriber_message_callback);
+
+		result = mosquitto_connect (sub->mosq, mq_args.host_name, mq_args.port, MOSQ_KEEPALIVE_TIMEOUT, true);
+		if (result == MOSQ_ERR_SUCCESS) {
+			result = mosquitto_subscribe (sub->mosq, 0, &mq_args.topic_name[0], mq_args.qos);
+		}
+		if (result != MOSQ_ERR_SUCCESS) {
+			mq_util_print_error (result);
+			return -1;
+		}
+		if (mq_mux_add (&mq_mux, shard, sub->mosq) == -1) {
+			return -1;
 		}
-		rx_avg = rx_avg / index;
-		tx_avg = tx_avg / index;
-
-		printf ("Jitter ------------------------------------------------\n");
-		printf("TX: %d pairs, %4ld / %4ld / %6.2f usec\n", index, tx_min, tx_max, tx_avg);
-		printf("RX: %d pairs, %4ld / %4ld / %6.2f usec\n", index, rx_min, rx_max, rx_avg);
 	}
+	mq_log_info ("%d subscribers on %d threads", mq_args.num_subscribers - 1, mq_args.mux_threads);
+	return mq_mux_start (&mq_mux);
 }
 
 
-void dump_delay_stats() {
-
-	DelayStat* dly_s = 0;
-
-	int index = 0;
-	long dly_min = 0L;
-	long dly_max = 0L;
-	double dly_avg = 0.0;
-
-	if (mq_delay_stats) {
-		while ( (dly_s = (mq_delay_stats + index)) != 0) {
-
-			if (dly_s->mid == 0) break;
-
-			printf ("%4d %6ld usec\n", dly_s->mid, dly_s->usec_tx_delay);
-			if (index) {
-				if (dly_s->usec_tx_delay < dly_min) dly_min = dly_s->usec_tx_delay;
-				if (dly_s->usec_tx_delay > dly_max) dly_max = dly_s->usec_tx_delay;
-			} else {
-				dly_min = dly_s->usec_tx_delay;
-				dly_max = dly_s->usec_tx_delay;
-			}
-			dly_avg += dly_s->usec_tx_delay;
-			index++;
-		}
-		dly_avg = dly_avg / index;
-		printf ("Delay ------------------------------------------------\n");
-		printf("%d samples, %ld / %ld / %6.2f usec\n", index, dly_min, dly_max, dly_avg);
-	}
+void dump_rx_stats() {
+	mq_rxstats_dump (&mq_rx_stats);
 }
 
 
@@ -351,6 +684,9 @@ int main (int ac, char** av) {
 	struct mosquitto* mosq = 0;
 	int result = MOSQ_ERR_SUCCESS;
 	uint16_t  smid = 0; // subscribe message id!
+	char clocksync_req_topic[MAX_TOPIC_NAME_LEN + 8];
+	char clocksync_req[MQ_CLOCKSYNC_MAX_MSG_LEN];
+	int index = 0;
 
 	bname = strdup (basename(av[0]));
 	client_id = malloc (strlen(bname) + 16); // space for pid
@@ -369,6 +705,23 @@ int main (int ac, char** av) {
 
 	mq_log_info ("This subscriber id is '%s'", client_id);
 
+	if (mq_rxstats_init (&mq_rx_stats, mq_args.hist_bits, mq_args.topic_name, mq_args.report_secs,
+			mq_args.report_json ? MQ_REPORT_JSON : MQ_REPORT_CSV) == -1) {
+		exit (EXIT_FAILURE);
+	}
+
+	if (mq_args.report_secs > 0) {
+		mq_report_header (mq_args.report_json ? MQ_REPORT_JSON : MQ_REPORT_CSV, "delay", "jitter");
+	}
+	if (mq_args.capture_file[0] &&
+		mq_capture_create (&mq_capture, mq_args.capture_file, mq_args.capture_records, bname, mq_args.clock) == -1) {
+		exit (EXIT_FAILURE);
+	}
+	mq_report_start (&mq_rx_stats.report, mq_clock_now ());
+	if (stats_thread_start (&mq_stats_thread, mq_args.num_subscribers > 1 ? 1 + mq_args.mux_threads : 1) == -1) {
+		exit (EXIT_FAILURE);
+	}
+
 	// now we can start mqtt staff
 	mosquitto_lib_init ();
 	mosq = mosquitto_new (client_id, 0);
@@ -397,10 +750,43 @@ int main (int ac, char** av) {
 	}
 	mq_log_info ("Subscribed with message id %d",smid);
 
+	if (mq_args.kernel_tstamps && mq_tstamp_enable_rx (mosquitto_socket (mosq)) == -1) {
+		goto cleanup;
+	}
+
+	if (mq_args.num_subscribers > 1 && start_subscribers (client_id) == -1) {
+		goto cleanup;
+	}
+
+	mq_clocksync_init (&mq_clocksync, mq_args.resync_secs);
+	if (mq_args.control_topic[0]) {
+		snprintf (clocksync_req_topic, sizeof(clocksync_req_topic), "%s/req", mq_args.control_topic);
+		snprintf (mq_clocksync_reply_topic, sizeof(mq_clocksync_reply_topic), "%s/rep/%s",
+				mq_args.control_topic, client_id);
+		result = mosquitto_subscribe (mosq, 0, mq_clocksync_reply_topic, 0);
+		if (result != MOSQ_ERR_SUCCESS) {
+			mq_util_print_error (result);
+			goto cleanup;
+		}
+	}
 
 	do {
 
-		result = mosquitto_loop(mosq,MOSQ_LOOP_TIMEOUT);
+		if (mq_args.kernel_tstamps) {
+			// wait here, so that the stamp is of what mosquitto_loop reads next
+			mq_kernel_rxtime = mq_tstamp_wait_rx (mosquitto_socket (mosq), mosquitto_want_write (mosq),
+					MOSQ_LOOP_TIMEOUT);
+			result = mosquitto_loop(mosq, 0);
+		} else {
+			result = mosquitto_loop(mosq,MOSQ_LOOP_TIMEOUT);
+		}
+
+		if (result == MOSQ_ERR_SUCCESS && mq_args.control_topic[0] &&
+			mq_clocksync_poll (&mq_clocksync, mq_clock_now () / 1000, mq_clocksync_reply_topic,
+					clocksync_req, sizeof(clocksync_req))) {
+			result = mosquitto_publish (mosq, 0, clocksync_req_topic, strlen (clocksync_req),
+					(uint8_t*) clocksync_req, 0, false);
+		}
 
 	} while (result == MOSQ_ERR_SUCCESS);
 
@@ -408,14 +794,18 @@ int main (int ac, char** av) {
 	cleanup:
 
 
-	if (mq_jitter_stats) {
-		free (mq_jitter_stats);
-		mq_jitter_stats = 0;
-	}
-	if (mq_delay_stats) {
-		free (mq_delay_stats);
-		mq_delay_stats = 0;
+	mq_mux_stop (&mq_mux);
+	stats_thread_stop (&mq_stats_thread);
+	stats_thread_destroy (&mq_stats_thread);
+	mq_capture_close (&mq_capture);
+	mq_rxstats_destroy (&mq_rx_stats);
+	if (mq_subscribers) {
+		for (index = 1; index < mq_args.num_subscribers; index++) {
+			if (mq_subscribers[index].mosq) mosquitto_destroy (mq_subscribers[index].mosq);
+		}
+		free (mq_subscribers);
 	}
+	mq_mux_destroy (&mq_mux);
 
 	mosquitto_destroy (mosq);
 	mosquitto_lib_cleanup();
@@ -3,27 +3,60 @@
  *
  * mqproducer -s <size> -n <iterations> -f <frequency>
  *            -t <topicname> -q <qos> -d <debuglevel> -h <broker-host> -p <broker-port>
+ *            -c <num-publishers> -P <load-profile> -r <reply-topic-prefix>
+ *            -o <control-topic> -C -k <clock> -i <report-interval> -j
  *            -?
  *
+ * runs <num-publishers> publishers, each on its own thread w/ its own mosquitto
+ * instance. when there are more than one publisher, publisher n publishes
+ * to '<topicname>/n'
+ *
+ * w/ -r publishers subscribe to '<reply-topic-prefix>/<topic>', where mqconsumer -r
+ * echoes the messages back, and measure the round trip time w/ their own clock.
+ *
+ * w/ -o a time responder answers the clock offset requests mqconsumer -o sends
+ * on '<control-topic>/req', so that the consumer can correct the one way delay.
+ *
+ * w/ -C every payload is stamped w/ a CRC32C that the consumers verify.
+ *
+ * w/ -i every publisher prints a CSV (or w/ -j JSON) line every <report-interval>
+ * seconds: messages and bytes per second, QoS handshake and schedule lateness
+ * percentiles of the interval.
+ *
  */
 
 #include <sys/types.h>
+#include <sys/time.h>
 
 #include <stdlib.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <mosquitto.h>
 
 #include "mq_log.h"
 #include "mq_util.h"
 #include "mq_message.h"
+#include "mq_pace.h"
+#include "mq_profile.h"
+#include "mq_inflight.h"
+#include "mq_tstamp.h"
+#include "mq_hist.h"
+#include "mq_clocksync.h"
+#include "mq_clock.h"
+#include "mq_report.h"
 
 
 #define MAX_TOPIC_NAME_LEN 1024  // seems big enough
 #define MAX_HOST_NAME_LEN 256
+#define MAX_CLIENT_ID_LEN 128
+#define MAX_PROFILE_LEN 1024
+#define MAX_PAYLOAD_SPEC_LEN 1024
+#define MAX_CLOCK_NAME_LEN 16
 
 #ifdef MOSQ_DEBUG
   #define MOSQ_LOG_LEVEL  (MOSQ_LOG_DEBUG | MOSQ_LOG_ERR | MOSQ_LOG_WARNING | \
@@ -36,13 +69,18 @@
 
 #define MOSQ_DEFAULT_HOST "localhost"
 #define MOSQ_DEFAULT_PORT 1883
-#define MOSQ_DEFAULT_PAYLOAD_SIZE 256 // Bytes
-#define MOSQ_DEFAULT_PUB_FREQ 1 // Hz
+#define MOSQ_DEFAULT_PAYLOAD_SIZE "256" // Bytes
+#define MOSQ_DEFAULT_PUB_FREQ 1.0 // Hz
+#define MOSQ_DEFAULT_SPIN_USEC 0 // sleep all the way to the deadline
 #define MOSQ_DEFAULT_NUM_MESSAGES 1000
+#define MOSQ_DEFAULT_NUM_PUBLISHERS 1
 
 #define MOSQ_KEEPALIVE_TIMEOUT 10 // seconds
 
+#define MOSQ_DRAIN_TIMEOUT 5 // seconds to wait for in-flight messages at exit
+
 #define MOSQ_DEFAULT_LOOP_MSEC 0 // msec, almost quantum!
+#define MOSQ_DRAIN_LOOP_MSEC 1 // msec, wait for the socket to become writable
 
 typedef struct Args {
 	char topic_name[MAX_TOPIC_NAME_LEN];
@@ -50,13 +88,96 @@ typedef struct Args {
 	int port;
 	int qos;
 	int debug_level;
-	int payload_size;
-	int pub_freq;
+	char payload_size[MAX_PAYLOAD_SPEC_LEN];
+	double pub_freq;
+	long spin_usec;
 	int num_messages;
+	int num_publishers;
+	char profile[MAX_PROFILE_LEN];
+	char reply_topic[MAX_TOPIC_NAME_LEN]; // echo prefix, empty if not measuring rtt
+	char control_topic[MAX_TOPIC_NAME_LEN]; // clock sync, empty if not answering
+	int crc; // stamp payload crcs
+	char clock[MAX_CLOCK_NAME_LEN];
+	double report_secs; // 0: no interval reports
+	int report_json;
+	int kernel_tstamps; // SO_TIMESTAMPING tx stamps
 } Args;
 
+/**
+ * per message cost of the send path (nsec) and lateness of each send
+ */
+typedef struct SendPath {
+	MqHist renew;   // mq_message_renew
+	MqHist publish; // mosquitto_publish
+	MqHist loop;    // mosquitto_loop(s)
+	MqHist sleep;   // pacing wait
+	MqHist late;    // lateness w.r.t. the schedule
+	MqHist stack;   // txtime -> kernel tx, w/ -K
+} SendPath;
+
+/**
+ * state of a single publisher. each publisher owns a mosquitto instance
+ * and runs its send loop on its own thread.
+ */
+typedef struct Publisher {
+	int index;
+	uint32_t producer_id; // in the message headers
+	pthread_t thread;
+	char topic_name[MAX_TOPIC_NAME_LEN + 16]; // space for '/<n>'
+	char reply_topic[2 * MAX_TOPIC_NAME_LEN + 16];
+	char client_id[MAX_CLIENT_ID_LEN];
+	struct mosquitto* mosq;
+	int result;        // last mosquitto result of the send loop
+	int sent_count;    // successfully published messages
+	int64_t sent_bytes;
+	struct timeval start_tv; // first publish
+	struct timeval end_tv;   // last publish
+	MqPacer pacer;
+	MqProfile profile;
+	MqMessageCtx msg_ctx;
+	MqInflight inflight; // QoS 1/2 only
+	int terminating;     // terminating ZERO sized message is published
+	uint16_t term_mid;
+	int term_acked;
+	SendPath send_path;
+	MqTxStamps tx_stamps; // w/ -K
+	MqHist rtt;          // echo round trip, nsec
+	int echo_count;
+	MqReport report;     // interval report; latency: QoS handshake, jitter: lateness
+} Publisher;
+
 static Args mq_args;
 
+static MqPayloadDist mq_payload_dist;
+
+static Publisher* mq_publishers = 0;
+
+/**
+ * start gate; publishers wait here until all of them are connected and
+ * done w/ their setup (payload pools, in-flight table) so that they start
+ * publishing (almost) at the same time
+ */
+static pthread_mutex_t mq_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mq_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t mq_ready_cond = PTHREAD_COND_INITIALIZER;
+static int mq_start_flag = 0;
+static int mq_ready_count = 0; // publishers set up, or given up
+
+/**
+ * time responder; its own mosquitto instance on its own thread, so that
+ * answering clock offset requests does not wait for the send loops
+ */
+typedef struct TimeResponder {
+	pthread_t thread;
+	char client_id[MAX_CLIENT_ID_LEN + 8];
+	struct mosquitto* mosq;
+	int started;       // the thread is running
+	int stop;          // __atomic, set by main
+	int served;
+} TimeResponder;
+
+static TimeResponder mq_time_responder;
+
 /**
  * print_usage
  */
@@ -64,9 +185,23 @@ static void print_usage () {
 	fprintf (stderr, "Usage: mqproducer -t <topicname>\n"
 			         "                  [-q <qos> (0-2)]\n"
 			         "                  [-d <debuglevel> (0-3)]\n"
-				     "                  [-s <payloadsize> (256B)]\n"
-				     "                  [-f <publish-frequency> (1Hz)]\n"
+				     "                  [-s <payloadsize> (256B) | <min>-<max> | @<histogram-file>]\n"
+				     "                  [-f <publish-frequency> (1Hz, 0: as fast as possible)]\n"
+				     "                  [-w <spin-usec-before-each-send> (0)]\n"
 				     "                  [-n <number-of-messages> (1000)]\n"
+				     "                  [-c <num-publishers> (1)]\n"
+				     "                  [-P <load-profile> (const)]\n"
+				     "                      const | ramp:<from-hz>:<to-hz>:<secs>[:<phases>]\n"
+				     "                      step:<hz>,<hz>,...:<secs-per-step>\n"
+				     "                      burst:<base-hz>:<peak-hz>:<period-secs>:<burst-secs>\n"
+				     "                      poisson:<mean-hz>\n"
+				     "                  [-r <reply-topic-prefix> (measure rtt of echoes from mqconsumer -r)]\n"
+				     "                  [-o <control-topic> (answer clock offset requests of mqconsumer -o)]\n"
+				     "                  [-C (stamp a CRC32C on every payload)]\n"
+				     "                  [-k <clock> (realtime | monotonic | tsc)]\n"
+				     "                  [-i <report-interval-secs> (0: only at the end)]\n"
+				     "                  [-j (interval reports in JSON instead of CSV)]\n"
+				     "                  [-K (kernel tx timestamps, time spent in the producer's stack)]\n"
 			         "                  [-h <broker-host> (localhost)]\n"
 			         "                  [-p <broker-port> (1883)]\n"
 				     "                  -? (prints out this usage)\n");
@@ -77,17 +212,28 @@ static void print_usage () {
  */
 static int parse_args(int ac, char** av) {
 	int c = 0;
+	MqProfile profile;
 
 	memset(mq_args.topic_name, 0, MAX_TOPIC_NAME_LEN);
 	mq_args.qos = 0;
 	mq_args.debug_level = MQ_LOG_ERROR; // error!
 	strncpy (mq_args.host_name, MOSQ_DEFAULT_HOST, MAX_HOST_NAME_LEN);
 	mq_args.port = MOSQ_DEFAULT_PORT;
-	mq_args.payload_size = MOSQ_DEFAULT_PAYLOAD_SIZE;
+	strncpy (mq_args.payload_size, MOSQ_DEFAULT_PAYLOAD_SIZE, MAX_PAYLOAD_SPEC_LEN);
 	mq_args.pub_freq = MOSQ_DEFAULT_PUB_FREQ;
+	mq_args.spin_usec = MOSQ_DEFAULT_SPIN_USEC;
 	mq_args.num_messages = MOSQ_DEFAULT_NUM_MESSAGES;
+	mq_args.num_publishers = MOSQ_DEFAULT_NUM_PUBLISHERS;
+	memset(mq_args.profile, 0, MAX_PROFILE_LEN);
+	memset(mq_args.reply_topic, 0, MAX_TOPIC_NAME_LEN);
+	memset(mq_args.control_topic, 0, MAX_TOPIC_NAME_LEN);
+	mq_args.crc = 0;
+	strncpy (mq_args.clock, MQ_CLOCK_DEFAULT_SOURCE, MAX_CLOCK_NAME_LEN);
+	mq_args.report_secs = 0.0;
+	mq_args.report_json = 0;
+	mq_args.kernel_tstamps = 0;
 
-	while ((c = getopt(ac, av, "?t:q:d:h:p:s:f:n:")) != -1) {
+	while ((c = getopt(ac, av, "?t:q:d:h:p:s:f:w:n:c:P:r:o:Ck:i:jK")) != -1) {
 		switch (c) {
 		case '?':
 			print_usage();
@@ -109,14 +255,44 @@ static int parse_args(int ac, char** av) {
 			mq_args.port = atoi (optarg);
 			break;
 		case 's':
-			mq_args.payload_size = atoi (optarg);
+			strncpy (mq_args.payload_size, optarg, MAX_PAYLOAD_SPEC_LEN - 1);
 			break;
 		case 'f':
-			mq_args.pub_freq = atoi (optarg);
+			mq_args.pub_freq = atof (optarg);
+			break;
+		case 'w':
+			mq_args.spin_usec = atol (optarg);
 			break;
 		case 'n':
 			mq_args.num_messages = atoi(optarg);
 			break;
+		case 'c':
+			mq_args.num_publishers = atoi(optarg);
+			break;
+		case 'P':
+			strncpy (mq_args.profile, optarg, MAX_PROFILE_LEN - 1);
+			break;
+		case 'r':
+			strncpy (mq_args.reply_topic, optarg, MAX_TOPIC_NAME_LEN - 1);
+			break;
+		case 'o':
+			strncpy (mq_args.control_topic, optarg, MAX_TOPIC_NAME_LEN - 1);
+			break;
+		case 'C':
+			mq_args.crc = 1;
+			break;
+		case 'k':
+			strncpy (mq_args.clock, optarg, MAX_CLOCK_NAME_LEN - 1);
+			break;
+		case 'i':
+			mq_args.report_secs = atof (optarg);
+			break;
+		case 'j':
+			mq_args.report_json = 1;
+			break;
+		case 'K':
+			mq_args.kernel_tstamps = 1;
+			break;
 		default:
 			mq_log_error ("'%c' %s",c, "unknown parameter!");
 			return -1;
@@ -133,6 +309,33 @@ static int parse_args(int ac, char** av) {
 		return -1;
 	}
 
+	if (mq_args.num_publishers <= 0) {
+		mq_log_error ("%s", "There must be at least one publisher");
+		return -1;
+	}
+
+	if (mq_payload_parse (&mq_payload_dist, mq_args.payload_size) == -1) {
+		return -1;
+	}
+
+	if (mq_payload_dist.min < MQ_MESSAGE_HEADER_SIZE) {
+		mq_log_error ("Payload size must be at least %d", (int) MQ_MESSAGE_HEADER_SIZE);
+		return -1;
+	}
+
+	if (mq_args.report_secs < 0) {
+		mq_log_error ("%s", "Report interval cannot be negative");
+		return -1;
+	}
+
+	if (mq_profile_parse (&profile, mq_args.profile, mq_args.pub_freq, 0) == -1) {
+		return -1;
+	}
+
+	if (mq_clock_init (mq_args.clock) == -1) {
+		return -1;
+	}
+
 	mq_log_debug ("'%s', %d, %d", mq_args.topic_name, mq_args.qos, mq_args.debug_level);
 	return 0;
 }
@@ -143,8 +346,10 @@ static int parse_args(int ac, char** av) {
  */
 static void mq_connect_callback(void* obj, int result) {
 
+	Publisher* pub = (Publisher*) obj;
+
 	if(!result){
-		mq_log_info ("Connected!\n");
+		mq_log_info ("Connected! (%s)\n", pub->client_id);
 	}else{
 		mq_util_print_error (result);
 	}
@@ -160,91 +365,341 @@ static void mq_disconnect_callback(void* obj) {
 }
 
 
-//static void mq_publish_callback(void* obj, uint16_t mid) {
-//	// @@ TODO
-//	mq_log_debug("mq_publish_callback");
-//}
+/**
+ * called when a QoS 0 message is written, or when the PUBACK (QoS 1) or
+ * PUBCOMP (QoS 2) of the message arrives
+ */
+static void mq_publish_callback(void* obj, uint16_t mid) {
+
+	Publisher* pub = (Publisher*) obj;
+	int64_t now = 0;
+	int64_t sent = 0;
+
+	mq_log_debug("mq_publish_callback for %d", mid);
+
+	if (pub->terminating && mid == pub->term_mid) {
+		pub->term_acked = 1;
+	} else if (mq_args.qos > 0) {
+		now = mq_clock_now ();
+		sent = pub->inflight.sent_nsec[mid];
+		if (mq_inflight_acked (&pub->inflight, mid, now) == 0) {
+			mq_hist_record (&pub->report.latency, now - sent);
+		}
+	}
+}
+
+
+/**
+ * an echoed message is back; the round trip is measured w/ the publisher's own clock
+ */
+static void mq_on_message_callback(void* obj, const struct mosquitto_message* msg) {
+
+	Publisher* pub = (Publisher*) obj;
+	int64_t now = mq_clock_now ();
+	const MqMessageHeader* hdr = mq_message_header (msg->payload, msg->payloadlen);
+
+	if (!hdr) {
+		return;
+	}
+	mq_hist_record (&pub->rtt, now - mq_message_txtime (hdr));
+	pub->echo_count++;
+}
+
+
+/**
+ * creates the mosquitto instance of the publisher and connects to the broker
+ */
+static int publisher_connect (Publisher* pub) {
 
-int main (int ac, char** av) {
-	char* bname = 0;
-	char* client_id = 0;
-	struct mosquitto* mosq = 0;
 	int result = MOSQ_ERR_SUCCESS;
-	int pub_message_count = 0;
-	uint16_t pmid = 0; // published message id!
-	byte* msg = 0;
-	struct timeval t1;
 
-	bname = strdup (basename(av[0]));
-	client_id = malloc (strlen(bname) + 16); // space for pid
-	sprintf (client_id, "%s_%d", bname, getpid());
+	// publisher is the callback object, so the callbacks know whom they serve
+	pub->mosq = mosquitto_new (pub->client_id, pub);
+	if (!pub->mosq) {
+		mq_log_error ("Error creating mosquito instance!");
+		return -1;
+	}
+	mosquitto_log_init (pub->mosq, MOSQ_LOG_LEVEL, MOSQ_LOG_STDERR);
 
-	// log needs to be initialized for parse_args and print_usage!
-	mq_log_init (client_id, MQ_LOG_ERROR);
+	mosquitto_connect_callback_set(pub->mosq, mq_connect_callback);
+	mosquitto_disconnect_callback_set(pub->mosq, mq_disconnect_callback);
+	mosquitto_publish_callback_set(pub->mosq, mq_publish_callback);
+	mosquitto_message_callback_set(pub->mosq, mq_on_message_callback);
 
-	if (parse_args (ac, av) == -1) {
-		print_usage ();
-		exit(EXIT_FAILURE);
-		// does not reach here!
+	result = mosquitto_connect(pub->mosq, mq_args.host_name, mq_args.port, MOSQ_KEEPALIVE_TIMEOUT, true);
+	if (result != MOSQ_ERR_SUCCESS) {
+		mq_util_print_error (result);
+		return -1;
 	}
-	// re-set log level
-	mq_log_set_debug_level (mq_args.debug_level);
+	mq_tstamp_tx_init (&pub->tx_stamps);
+	if (mq_args.kernel_tstamps && mq_tstamp_enable_tx (mosquitto_socket (pub->mosq)) == -1) {
+		return -1;
+	}
+
+	if (pub->reply_topic[0]) {
+		result = mosquitto_subscribe (pub->mosq, 0, pub->reply_topic, mq_args.qos);
+		if (result != MOSQ_ERR_SUCCESS) {
+			mq_util_print_error (result);
+			return -1;
+		}
+	}
+	return 0;
+}
 
-	mq_log_info ("This subscriber id is '%s'", client_id);
 
-	// now we can start mqtt staff
-	mosquitto_lib_init ();
-	mosq = mosquitto_new (client_id, 0);
-	if (!mosq) {
+/**
+ * a clock offset request; t2 is taken as early and t3 as late as possible,
+ * once the rest of the answer is formatted
+ */
+static void mq_time_request_callback(void* obj, const struct mosquitto_message* msg) {
+
+	TimeResponder* tr = (TimeResponder*) obj;
+	char reply_topic[MAX_TOPIC_NAME_LEN];
+	char answer[MQ_CLOCKSYNC_MAX_MSG_LEN];
+	int64_t t2 = mq_clock_now () / 1000;
+	int len = 0;
+
+	len = mq_clocksync_serve ((const char*) msg->payload, msg->payloadlen, t2,
+			reply_topic, sizeof(reply_topic), answer, sizeof(answer));
+	if (len == -1) {
+		return;
+	}
+	len = mq_clocksync_stamp (answer, len, sizeof(answer), mq_clock_now () / 1000);
+	mosquitto_publish (tr->mosq, 0, reply_topic, len, (uint8_t*) answer, 0, false);
+	tr->served++;
+}
+
+
+/**
+ * connects the time responder and subscribes to '<control-topic>/req'
+ */
+static int time_responder_connect (TimeResponder* tr, const char* client_id) {
+
+	char topic[MAX_TOPIC_NAME_LEN + 8];
+	int result = MOSQ_ERR_SUCCESS;
+
+	snprintf (tr->client_id, sizeof(tr->client_id), "%s_time", client_id);
+	tr->mosq = mosquitto_new (tr->client_id, tr);
+	if (!tr->mosq) {
 		mq_log_error ("Error creating mosquito instance!");
-		exit (EXIT_FAILURE);
+		return -1;
+	}
+	mosquitto_log_init (tr->mosq, MOSQ_LOG_LEVEL, MOSQ_LOG_STDERR);
+	mosquitto_message_callback_set(tr->mosq, mq_time_request_callback);
+
+	result = mosquitto_connect(tr->mosq, mq_args.host_name, mq_args.port, MOSQ_KEEPALIVE_TIMEOUT, true);
+	if (result != MOSQ_ERR_SUCCESS) {
+		mq_util_print_error (result);
+		return -1;
 	}
-	mosquitto_log_init (mosq, MOSQ_LOG_LEVEL, MOSQ_LOG_STDERR);
 
-	mosquitto_connect_callback_set(mosq, mq_connect_callback);
-	mosquitto_disconnect_callback_set(mosq, mq_disconnect_callback);
-	// mosquitto_publish_callback_set(mosq, mq_publish_callback);
+	snprintf (topic, sizeof(topic), "%s/req", mq_args.control_topic);
+	result = mosquitto_subscribe (tr->mosq, 0, topic, 0);
+	if (result != MOSQ_ERR_SUCCESS) {
+		mq_util_print_error (result);
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * time responder thread; answers until the publishers are done
+ */
+static void* time_responder_run (void* arg) {
+
+	TimeResponder* tr = (TimeResponder*) arg;
+	int result = MOSQ_ERR_SUCCESS;
 
-	result = mosquitto_connect(mosq, mq_args.host_name, mq_args.port, MOSQ_KEEPALIVE_TIMEOUT, true);
+	while (!__atomic_load_n (&tr->stop, __ATOMIC_RELAXED) && result == MOSQ_ERR_SUCCESS) {
+		result = mosquitto_loop (tr->mosq, MOSQ_LOOP_TIMEOUT);
+	}
 	if (result != MOSQ_ERR_SUCCESS) {
 		mq_util_print_error (result);
-		goto cleanup;
 	}
+	return 0;
+}
+
+
+static int send_path_init (SendPath* sp) {
+	if (mq_hist_init (&sp->renew, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&sp->publish, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&sp->loop, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&sp->sleep, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&sp->late, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&sp->stack, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+static void send_path_merge (SendPath* dst, const SendPath* src) {
+	mq_hist_merge (&dst->renew, &src->renew);
+	mq_hist_merge (&dst->publish, &src->publish);
+	mq_hist_merge (&dst->loop, &src->loop);
+	mq_hist_merge (&dst->sleep, &src->sleep);
+	mq_hist_merge (&dst->late, &src->late);
+	mq_hist_merge (&dst->stack, &src->stack);
+}
+
+static void send_path_destroy (SendPath* sp) {
+	mq_hist_destroy (&sp->renew);
+	mq_hist_destroy (&sp->publish);
+	mq_hist_destroy (&sp->loop);
+	mq_hist_destroy (&sp->sleep);
+	mq_hist_destroy (&sp->late);
+	mq_hist_destroy (&sp->stack);
+}
+
+
+/**
+ * runs the network loop of the publisher.
+ *
+ * when paced a single loop per publish is enough. unpaced (-f 0) publish
+ * queues messages much faster than a single loop writes them, so the loop
+ * is run until the outgoing queue is empty. this is the back pressure that
+ * keeps the queue (and the memory) bounded at the broker's ceiling.
+ */
+static int publisher_loop (Publisher* pub) {
 
-	mq_message_init (mq_args.payload_size);
+	int result = mosquitto_loop(pub->mosq, MOSQ_DEFAULT_LOOP_MSEC);
+
+	if (pub->pacer.period_nsec == 0) {
+		while (result == MOSQ_ERR_SUCCESS && mosquitto_want_write (pub->mosq)) {
+			result = mosquitto_loop(pub->mosq, MOSQ_DRAIN_LOOP_MSEC);
+		}
+	}
+	// a stamp taken when nothing is left to write covers every message published so far
+	if (mq_args.kernel_tstamps && result == MOSQ_ERR_SUCCESS && !mosquitto_want_write (pub->mosq)) {
+		mq_tstamp_tx_collect (&pub->tx_stamps, mosquitto_socket (pub->mosq), &pub->send_path.stack);
+	}
+	return result;
+}
+
+
+/**
+ * messages given up on once the drain is over: still unacked (QoS 1/2) or,
+ * w/ echoes, never echoed. nothing counts as lost while the publisher sends
+ */
+static int64_t publisher_lost (const Publisher* pub) {
+
+	int64_t lost = mq_args.qos > 0 ? pub->inflight.count : 0;
+
+	if (pub->reply_topic[0] && pub->sent_count - pub->echo_count > lost) {
+		lost = pub->sent_count - pub->echo_count;
+	}
+	return lost;
+}
+
+/**
+ * publisher thread; waits at the start gate, then publishes
+ * mq_args.num_messages messages and the terminating ZERO sized message
+ */
+static void* publisher_run (void* arg) {
+
+	Publisher* pub = (Publisher*) arg;
+	int result = MOSQ_ERR_SUCCESS;
+	uint16_t pmid = 0; // published message id!
+	byte* msg = 0;
+	int phase = 0;
+	int64_t period_nsec = 0;
+	int64_t late_nsec = 0;
+	int size = 0;
+	int64_t drain_deadline = 0;
+	int64_t t0 = 0, t1 = 0, t2 = 0, t3 = 0, t4 = 0; // send path timestamps
+	SendPath* sp = &pub->send_path;
+	int ready = 1;
+
+	if (mq_args.qos > 0 && mq_inflight_init (&pub->inflight) == -1) {
+		ready = 0;
+	} else if (mq_message_init (&pub->msg_ctx, &mq_payload_dist, pub->producer_id,
+			(int) pub->producer_id, mq_args.crc) == -1) {
+		mq_message_destroy (&pub->msg_ctx);
+		ready = 0;
+	}
+	mq_pace_init (&pub->pacer, mq_args.pub_freq, mq_args.spin_usec);
+
+	// counted either way, so that main does not wait for a publisher that gave up
+	pthread_mutex_lock (&mq_start_mutex);
+	mq_ready_count++;
+	pthread_cond_signal (&mq_ready_cond);
+	pthread_mutex_unlock (&mq_start_mutex);
+	if (!ready) {
+		return 0;
+	}
+
+	pthread_mutex_lock (&mq_start_mutex);
+	while (!mq_start_flag) {
+		pthread_cond_wait (&mq_start_cond, &mq_start_mutex);
+	}
+	pthread_mutex_unlock (&mq_start_mutex);
+
+	gettimeofday(&pub->start_tv, 0);
+	mq_pace_start (&pub->pacer);
+	mq_report_start (&pub->report, mq_clock_now ());
 
 	do {
-		gettimeofday(&t1, 0);
-		msg = mq_message_renew();
+		phase = mq_profile_next (&pub->profile, mq_pace_elapsed_nsec (&pub->pacer), &period_nsec);
+		mq_pace_set_period (&pub->pacer, period_nsec);
+
+		t0 = mq_clock_now ();
+		late_nsec = mq_pace_wait (&pub->pacer);
+		t1 = mq_clock_now ();
+		if (mq_report_due (&pub->report, t1)) {
+			mq_report_emit (&pub->report, t1, 0); // a slow profile waits for more than an interval
+		}
+		msg = mq_message_renew (&pub->msg_ctx, phase, late_nsec, &size);
 
-		//mq_message_dump (stdout, msg);
+		//mq_message_dump (stdout, (MqMessageHeader*) msg);
 
-		result = mosquitto_publish (mosq,
+		t2 = mq_clock_now ();
+		result = mosquitto_publish (pub->mosq,
 									&pmid,
-									mq_args.topic_name,
-									mq_args.payload_size,
+									pub->topic_name,
+									size,
 									(uint8_t*) msg,
 									mq_args.qos,
 									0 /*don't retain*/);
+		t3 = mq_clock_now ();
 		if (result != MOSQ_ERR_SUCCESS) {
 			break;
 		}
+		pub->sent_count++;
+		pub->sent_bytes += size;
+		mq_report_message (&pub->report, size);
+		if (mq_args.qos > 0) {
+			mq_inflight_sent (&pub->inflight, pmid, t2);
+		}
+		if (mq_args.kernel_tstamps) {
+			mq_tstamp_tx_sent (&pub->tx_stamps, mq_message_txtime ((const MqMessageHeader*) msg));
+		}
 
-		result = mosquitto_loop(mosq, MOSQ_DEFAULT_LOOP_MSEC);
+		result = publisher_loop (pub);
+		t4 = mq_clock_now ();
 
-		usleep (mq_util_sleep_usecs_for_next_request (mq_args.pub_freq, &t1));
+		mq_hist_record (&sp->sleep, t1 - t0);
+		mq_hist_record (&sp->late, late_nsec);
+		mq_hist_record (&sp->renew, t2 - t1);
+		mq_hist_record (&sp->publish, t3 - t2);
+		mq_hist_record (&sp->loop, t4 - t3);
+		mq_hist_record (&pub->report.jitter, late_nsec);
 
-		if (result != MOSQ_ERR_SUCCESS) {
-			break;
+		if (mq_report_due (&pub->report, t4)) {
+			mq_report_emit (&pub->report, t4, 0);
 		}
-	} while (result == MOSQ_ERR_SUCCESS && ++pub_message_count < mq_args.num_messages);
+	} while (result == MOSQ_ERR_SUCCESS && pub->sent_count < mq_args.num_messages);
+
+	gettimeofday(&pub->end_tv, 0);
 
 	if (result != MOSQ_ERR_SUCCESS) {
 		mq_util_print_error (result);
 	}
-	result = mosquitto_publish (mosq,
-								&pmid,
-								mq_args.topic_name,
+	pub->result = result;
+
+	pub->terminating = 1;
+	result = mosquitto_publish (pub->mosq,
+								&pub->term_mid,
+								pub->topic_name,
 								0, // ZERO sized message denotes disconnect to the consumer
 								0,
 								1, // make sure disconnect of the consumer
@@ -252,12 +707,357 @@ int main (int ac, char** av) {
 	if (result != MOSQ_ERR_SUCCESS) {
 		mq_util_print_error (result);
 	}
+
+	// wait for the acknowledgements of the messages still in flight and for the echoes
+	drain_deadline = mq_clock_now () + MOSQ_DRAIN_TIMEOUT * 1000000000LL;
+	while (result == MOSQ_ERR_SUCCESS &&
+		   (!pub->term_acked || pub->inflight.count > 0 ||
+			(pub->reply_topic[0] && pub->echo_count < pub->sent_count)) &&
+		   mq_clock_now () < drain_deadline) {
+		result = mosquitto_loop(pub->mosq, MOSQ_LOOP_TIMEOUT);
+		if (mq_args.kernel_tstamps && result == MOSQ_ERR_SUCCESS && !mosquitto_want_write (pub->mosq)) {
+			mq_tstamp_tx_collect (&pub->tx_stamps, mosquitto_socket (pub->mosq), &pub->send_path.stack);
+		}
+		if (mq_report_due (&pub->report, mq_clock_now ())) {
+			mq_report_emit (&pub->report, mq_clock_now (), 0); // the acks of the drain
+		}
+	}
+	if (pub->report.interval_nsec > 0) {
+		mq_report_emit (&pub->report, mq_clock_now (), publisher_lost (pub)); // the last, partial interval
+	}
+
+	mq_message_destroy (&pub->msg_ctx);
+
+	return 0;
+}
+
+
+static double msgs_per_sec (int count, long usec) {
+	return usec > 0 ? count * 1000000.0 / usec : 0.0;
+}
+
+/* payload MB (10^6 bytes) per second */
+static double mbytes_per_sec (int64_t bytes, long usec) {
+	return usec > 0 ? (double) bytes / usec : 0.0;
+}
+
+/**
+ * dumps the send path costs of all publishers
+ */
+static void dump_send_path_stats () {
+
+	SendPath all;
+	const MqTxStamps* ts = 0;
+	int64_t unstamped = 0;
+	int index = 0;
+
+	if (send_path_init (&all) == 0) {
+		for (index = 0; index < mq_args.num_publishers; index++) {
+			send_path_merge (&all, &mq_publishers[index].send_path);
+		}
+		mq_hist_dump_header ("Send path (usec)");
+		mq_hist_dump_row ("renew", &all.renew, 1000.0);
+		mq_hist_dump_row ("publish", &all.publish, 1000.0);
+		mq_hist_dump_row ("loop", &all.loop, 1000.0);
+		mq_hist_dump_row ("sleep", &all.sleep, 1000.0);
+		mq_hist_dump_row ("late", &all.late, 1000.0);
+		if (mq_args.kernel_tstamps) {
+			mq_hist_dump_row ("kernel tx", &all.stack, 1000.0);
+			for (index = 0; index < mq_args.num_publishers; index++) {
+				ts = &mq_publishers[index].tx_stamps;
+				unstamped += ts->unstamped + (int64_t) (ts->head - ts->tail);
+			}
+			if (unstamped > 0) {
+				printf ("%lld messages got no kernel tx stamp\n", (long long) unstamped);
+			}
+		}
+	}
+	send_path_destroy (&all);
+}
+
+/**
+ * dumps the echo round trip times of all publishers
+ */
+static void dump_rtt_stats () {
+
+	MqHist rtt;
+	int index = 0;
+	int echo_count = 0;
+	int sent_count = 0;
+
+	if (mq_hist_init (&rtt, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == 0) {
+		for (index = 0; index < mq_args.num_publishers; index++) {
+			mq_hist_merge (&rtt, &mq_publishers[index].rtt);
+			echo_count += mq_publishers[index].echo_count;
+			sent_count += mq_publishers[index].sent_count;
+		}
+		printf ("Round trip --------------------------------------------\n");
+		printf ("%d / %d messages echoed\n", echo_count, sent_count);
+		mq_hist_dump_header ("RTT (usec)");
+		mq_hist_dump_row ("rtt", &rtt, 1000.0);
+		mq_hist_dump_row ("rtt/2", &rtt, 2000.0);
+		mq_hist_destroy (&rtt);
+	}
+}
+
+/**
+ * dumps per publisher and aggregated send side results
+ */
+static void dump_publisher_stats () {
+
+	Publisher* pub = 0;
+	int index = 0;
+	int started = 0;
+	int total_sent = 0;
+	int64_t total_bytes = 0;
+	int total_failed = 0;
+	long elapsed_usec = 0;
+	struct timeval first_start = {0,0};
+	struct timeval last_start = {0,0};
+	struct timeval last_end = {0,0};
+	int64_t total_slip_nsec = 0;
+	int64_t max_slip_nsec = 0;
+	int total_acks = 0;
+	int peak_inflight = 0;
+	MqHist ack;
+	char title[64];
+
+	printf ("Publishers --------------------------------------------\n");
+	for (index = 0; index < mq_args.num_publishers; index++) {
+		pub = mq_publishers + index;
+
+		if (pub->start_tv.tv_sec == 0) {
+			printf ("[%4d] '%s' not started\n", pub->index, pub->topic_name);
+			total_failed++;
+			continue;
+		}
+		elapsed_usec = mq_util_timeval_diff_usec (pub->end_tv, pub->start_tv);
+		printf ("[%4d] '%s' %d / %d messages, %ld usec, %.1f msgs/s, %.3f MB/s%s\n",
+				pub->index, pub->topic_name,
+				pub->sent_count, mq_args.num_messages, elapsed_usec,
+				msgs_per_sec (pub->sent_count, elapsed_usec),
+				mbytes_per_sec (pub->sent_bytes, elapsed_usec),
+				pub->result == MOSQ_ERR_SUCCESS ? "" : " (failed)");
+		printf ("       slip: %lld late, %lld / %.2f usec total / avg, %.2f usec max\n",
+				(long long) pub->pacer.late_count,
+				(long long) (pub->pacer.slip_nsec / 1000),
+				pub->pacer.count ? pub->pacer.slip_nsec / 1000.0 / pub->pacer.count : 0.0,
+				pub->pacer.max_slip_nsec / 1000.0);
+		if (mq_args.qos > 0) {
+			printf ("       acks: %d acked, %d in flight at exit, %d peak in flight, %lld unknown\n",
+					pub->inflight.num_acks, pub->inflight.count, pub->inflight.peak,
+					(long long) pub->inflight.unknown);
+			total_acks += pub->inflight.num_acks;
+			if (pub->inflight.peak > peak_inflight) peak_inflight = pub->inflight.peak;
+		}
+		total_slip_nsec += pub->pacer.slip_nsec;
+		if (pub->pacer.max_slip_nsec > max_slip_nsec) max_slip_nsec = pub->pacer.max_slip_nsec;
+
+		if (pub->result != MOSQ_ERR_SUCCESS) total_failed++;
+		total_sent += pub->sent_count;
+		total_bytes += pub->sent_bytes;
+
+		if (!started || timercmp (&pub->start_tv, &first_start, <)) first_start = pub->start_tv;
+		if (!started || timercmp (&pub->start_tv, &last_start, >)) last_start = pub->start_tv;
+		if (!started || timercmp (&pub->end_tv, &last_end, >)) last_end = pub->end_tv;
+		started++;
+	}
+
+	if (started) {
+		elapsed_usec = mq_util_timeval_diff_usec (last_end, first_start);
+		printf ("TX: %d publishers (%d failed), '%s' profile, %d messages, %ld usec, start skew %ld usec\n",
+				mq_args.num_publishers, total_failed, mq_profile_name (&mq_publishers[0].profile),
+				total_sent, elapsed_usec,
+				mq_util_timeval_diff_usec (last_start, first_start));
+		printf ("TX: %.1f msgs/s, %.3f MB/s sustained\n",
+				msgs_per_sec (total_sent, elapsed_usec),
+				mbytes_per_sec (total_bytes, elapsed_usec));
+		printf ("TX: schedule slip %lld usec total, %.2f usec max\n",
+				(long long) (total_slip_nsec / 1000), max_slip_nsec / 1000.0);
+	}
+
+	if (mq_args.qos > 0 && total_acks > 0) {
+		printf ("TX: %d acks, %d peak in flight\n", total_acks, peak_inflight);
+
+		if (mq_hist_init (&ack, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1) {
+			return;
+		}
+		for (index = 0; index < mq_args.num_publishers; index++) {
+			pub = mq_publishers + index;
+			if (pub->inflight.sent_nsec) mq_hist_merge (&ack, &pub->inflight.ack);
+		}
+		snprintf (title, sizeof(title), "QoS %d handshake (usec)", mq_args.qos);
+		mq_hist_dump_header (title);
+		mq_hist_dump_row ("ack", &ack, 1000.0);
+		mq_hist_destroy (&ack);
+	}
+}
+
+
+/**
+ * first producer id of this process, the publishers take the ids following
+ * it. a hash (splitmix64) of the pid and the start time, so that the
+ * producers of different processes, on one host or more, do not collide
+ */
+static uint32_t producer_id_base () {
+
+	struct timeval tv;
+	uint64_t x = 0;
+
+	gettimeofday (&tv, 0);
+	x = ((uint64_t) getpid () << 32) ^ ((uint64_t) tv.tv_sec * 1000000 + (uint64_t) tv.tv_usec);
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return (uint32_t) x;
+}
+
+
+int main (int ac, char** av) {
+	char* bname = 0;
+	char* client_id = 0;
+	Publisher* pub = 0;
+	uint32_t producer_id = 0;
+	int index = 0;
+	int num_running = 0;
+
+	bname = strdup (basename(av[0]));
+	client_id = malloc (strlen(bname) + 16); // space for pid
+	sprintf (client_id, "%s_%d", bname, getpid());
+
+	// log needs to be initialized for parse_args and print_usage!
+	mq_log_init (client_id, MQ_LOG_ERROR);
+
+	if (parse_args (ac, av) == -1) {
+		print_usage ();
+		exit(EXIT_FAILURE);
+		// does not reach here!
+	}
+	// re-set log level
+	mq_log_set_debug_level (mq_args.debug_level);
+
+	mq_log_info ("This publisher id is '%s' (%d publishers)", client_id, mq_args.num_publishers);
+
+	mq_publishers = (Publisher*) malloc (mq_args.num_publishers * sizeof(Publisher));
+	if (!mq_publishers) {
+		mq_log_error ("Memory for publishers cannot be allocated!");
+		exit (EXIT_FAILURE);
+	}
+	memset (mq_publishers, 0, mq_args.num_publishers * sizeof(Publisher));
+
+	// now we can start mqtt staff
+	mosquitto_lib_init ();
+
+	// connect all publishers first, so that connection setup does not skew the start
+	producer_id = producer_id_base ();
+	mq_log_info ("Producer ids from %" PRIu32 ", in the consumers' stream tables", producer_id);
+	for (index = 0; index < mq_args.num_publishers; index++) {
+		pub = mq_publishers + index;
+		pub->index = index;
+		pub->producer_id = producer_id + (uint32_t) index; // unsigned, wraps around
+		pub->result = MOSQ_ERR_NO_CONN;
+		snprintf (pub->client_id, MAX_CLIENT_ID_LEN, "%s_%d", client_id, index);
+		if (mq_args.num_publishers == 1) {
+			snprintf (pub->topic_name, sizeof(pub->topic_name), "%s", mq_args.topic_name);
+		} else {
+			snprintf (pub->topic_name, sizeof(pub->topic_name), "%s/%d", mq_args.topic_name, index);
+		}
+
+		// parsed per publisher, so every publisher gets its own poisson arrivals
+		if (mq_profile_parse (&pub->profile, mq_args.profile, mq_args.pub_freq, (int) pub->producer_id) == -1) {
+			goto cleanup;
+		}
+
+		if (mq_args.reply_topic[0]) {
+			snprintf (pub->reply_topic, sizeof(pub->reply_topic), "%s/%s", mq_args.reply_topic, pub->topic_name);
+		}
+
+		if (send_path_init (&pub->send_path) == -1 ||
+			mq_hist_init (&pub->rtt, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+			mq_report_init (&pub->report, pub->topic_name, mq_args.report_secs,
+					mq_args.report_json ? MQ_REPORT_JSON : MQ_REPORT_CSV, "ack", "late",
+					MQ_HIST_DEFAULT_SUB_BITS) == -1) {
+			goto cleanup;
+		}
+
+		if (publisher_connect (pub) == -1) {
+			goto cleanup;
+		}
+	}
+
+	if (mq_args.control_topic[0]) {
+		if (time_responder_connect (&mq_time_responder, client_id) == -1) {
+			goto cleanup;
+		}
+		if (pthread_create (&mq_time_responder.thread, 0, time_responder_run, &mq_time_responder) != 0) {
+			mq_log_error ("Time responder thread cannot be created!");
+			goto cleanup;
+		}
+		mq_time_responder.started = 1;
+	}
+
+	if (mq_args.report_secs > 0) {
+		mq_report_header (mq_args.report_json ? MQ_REPORT_JSON : MQ_REPORT_CSV, "ack", "late");
+	}
+
+	for (index = 0; index < mq_args.num_publishers; index++) {
+		pub = mq_publishers + index;
+		if (pthread_create (&pub->thread, 0, publisher_run, pub) != 0) {
+			mq_log_error ("Publisher thread %d cannot be created!", index);
+			break;
+		}
+		num_running++;
+	}
+
+	// open the start gate once every publisher is set up
+	pthread_mutex_lock (&mq_start_mutex);
+	while (mq_ready_count < num_running) {
+		pthread_cond_wait (&mq_ready_cond, &mq_start_mutex);
+	}
+	mq_start_flag = 1;
+	pthread_cond_broadcast (&mq_start_cond);
+	pthread_mutex_unlock (&mq_start_mutex);
+
+	for (index = 0; index < num_running; index++) {
+		pthread_join (mq_publishers[index].thread, 0);
+	}
+
+	if (mq_time_responder.started) {
+		__atomic_store_n (&mq_time_responder.stop, 1, __ATOMIC_RELAXED);
+		pthread_join (mq_time_responder.thread, 0);
+		mq_log_info ("Clock offset requests answered: %d", mq_time_responder.served);
+	}
+
+	dump_publisher_stats ();
+	dump_send_path_stats ();
+	mq_clock_dump ();
+	if (mq_args.reply_topic[0]) {
+		dump_rtt_stats ();
+	}
+
 	/* CLEANUP LABEL*/
 	cleanup:
 
-	mq_message_destroy();
+	for (index = 0; index < mq_args.num_publishers; index++) {
+		pub = mq_publishers + index;
+		if (pub->mosq) {
+			mosquitto_destroy (pub->mosq);
+			pub->mosq = 0;
+		}
+		mq_inflight_destroy (&pub->inflight);
+		send_path_destroy (&pub->send_path);
+		mq_hist_destroy (&pub->rtt);
+		mq_report_destroy (&pub->report);
+	}
+	free (mq_publishers);
+	mq_publishers = 0;
+	if (mq_time_responder.mosq) {
+		mosquitto_destroy (mq_time_responder.mosq);
+		mq_time_responder.mosq = 0;
+	}
+	mq_payload_destroy (&mq_payload_dist);
 
-	mosquitto_destroy (mosq);
 	mosquitto_lib_cleanup();
 
 	mq_log_destroy();
@@ -2,11 +2,43 @@
  * $Id: sqconsumer.c 169 2012-02-21 10:07:29Z tufan $
  *
  * sqconsumer -t <topicname> -q <qos> -d <debuglevel> -h <host> -p <port>
- *            -n <num-topic-types>
+ *            -n <num-topic-types> -o <control-topic> -O <resync-interval>
+ *            -k <clock> -i <report-interval> -j -w <capture-file> -W <capture-records> -K
+ *            -x <export-db> -b <batch-rows> -B <batch-msec> -s <stats-threads>
+ *            -m <store-MiB> -f <spill-dir> -R <ring-samples>
  *
- * inserts given topics in memory sqlite db
+ * keeps the samples of given topics in an in-memory columnar store
  * terminates when receives num-topic-types null messages
  *
+ * the network thread only interns the topic to an id and hands the sample
+ * over to a writer thread through a lock-free ring; the writer appends it to
+ * the columns of its topic (mq_store), so neither storing nor growing the
+ * columns slows down the receive path or delays the rx stamps.
+ *
+ * w/ -m the store keeps at most that many MiB of samples in memory and
+ * spills the rest to a file in -f (see mq_store); the report streams the
+ * spilled samples back and takes the percentiles of topics whose delays do
+ * not fit into the budget from histograms.
+ *
+ * w/ -x the writer also inserts the samples into a sqlite db file in
+ * transactions of -b rows or -B msec, whichever comes first.
+ *
+ * w/ -o rx times are stored in the producer's clock, corrected w/ the offset
+ * estimated against mqproducer -o (see mqconsumer)
+ *
+ * jitter, delay and inter-arrival moments are kept per producer as the
+ * messages arrive (mq_stream); the delay percentiles are computed from the
+ * columns of the store at exit, a topic at a time by -s threads, and printed
+ * in topic order.
+ *
+ * w/ -i a CSV (or w/ -j JSON) line is printed every <report-interval> seconds,
+ * as in mqconsumer.
+ *
+ * w/ -K the delay is split at the kernel rx time of the messages (see mqconsumer).
+ *
+ * w/ -w every message is also appended to a capture file (see mqconsumer),
+ * which outlives the in-memory store.
+ *
  */
 
 #include <sys/types.h>
@@ -17,6 +49,9 @@
 #include <libgen.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <sqlite3.h>
 #include <mosquitto.h>
@@ -24,10 +59,22 @@
 #include "mq_log.h"
 #include "mq_util.h"
 #include "mq_message.h"
+#include "mq_stream.h"
+#include "mq_report.h"
+#include "mq_clocksync.h"
+#include "mq_clock.h"
+#include "mq_capture.h"
+#include "mq_tstamp.h"
+#include "mq_hist.h"
+#include "mq_ring.h"
+#include "mq_topic.h"
+#include "mq_store.h"
 
 
 #define MAX_TOPIC_NAME_LEN 1024  // seems big enough
 #define MAX_HOST_NAME_LEN 256
+#define MAX_CLOCK_NAME_LEN 16
+#define MAX_FILE_NAME_LEN 1024
 
 #ifdef MOSQ_DEBUG
   #define MOSQ_LOG_LEVEL  (MOSQ_LOG_DEBUG | MOSQ_LOG_ERR | MOSQ_LOG_WARNING | \
@@ -43,7 +90,13 @@
 
 #define MOSQ_KEEPALIVE_TIMEOUT 10 // seconds
 
-#define MOSQ_SQLITE_DBNAME ":memory:" // in-memory database
+#define MOSQ_DEFAULT_RESYNC_SECS 10
+
+#define MOSQ_STORE_DEFAULT_RING_SIZE 65536 // samples between the network and the writer thread
+#define MOSQ_STORE_MAX_RING_SIZE (1 << 24)
+#define MOSQ_STORE_IDLE_USEC 100     // writer thread sleep when the ring is empty
+#define MOSQ_DB_DEFAULT_BATCH_ROWS 1000
+#define MOSQ_DB_DEFAULT_BATCH_MSEC 100
 
 typedef struct Args {
 	char topic_name[MAX_TOPIC_NAME_LEN];
@@ -52,14 +105,95 @@ typedef struct Args {
 	int qos;
 	int num_topic_types;
 	int debug_level;
+	char control_topic[MAX_TOPIC_NAME_LEN]; // clock sync, empty if not correcting
+	int resync_secs; // 0: estimate once at start
+	char clock[MAX_CLOCK_NAME_LEN];
+	double report_secs; // 0: no interval reports
+	int report_json;
+	char capture_file[MAX_FILE_NAME_LEN]; // empty if not capturing
+	uint64_t capture_records;
+	int kernel_tstamps; // SO_TIMESTAMPING rx stamps
+	char export_file[MAX_FILE_NAME_LEN]; // sqlite db, empty if not exporting
+	int batch_rows;     // rows per transaction
+	int batch_msec;     // age of the oldest uncommitted row
+	int stats_threads;  // computing the report at exit
+	int store_mib;      // memory budget of the store, 0: unlimited
+	char spill_dir[MAX_FILE_NAME_LEN];
+	int ring_size;      // samples the writer may fall behind
 } Args;
 
 
-typedef struct MessageStat {
-	int mid;
-	struct timeval tx_tv;
-	struct timeval rx_tv;
-} MessageStat;
+/**
+ * a sample to store; rxtime_tx of the sample is the rx time stored
+ */
+typedef struct StoreRow {
+	MqCaptureRecord sample;
+	const char* topic; // interned in mq_topics
+	int topic_id;
+} StoreRow;
+
+/**
+ * writer thread; drains the ring into the store and, w/ -x, into the
+ * export db in batched transactions
+ */
+typedef struct StoreWriter {
+	MqRing ring;
+	MqStore store;
+	pthread_t thread;
+	int running;
+	int stop;
+	int64_t overruns;     // samples dropped by the network thread, the ring was full
+	int64_t failed;       // samples the store had no memory for
+	int64_t store_nsec;   // spent appending to the store
+	int64_t rows;         // exported
+	int64_t db_failed;    // rows the db refused, or lost w/ their transaction
+	int64_t tx_failed;    // transactions that could not begin or commit
+	int64_t commits;
+	int64_t db_nsec;      // spent inserting and committing
+	int64_t start;
+	int64_t end;
+	MqHist commit;        // BEGIN -> COMMIT of a batch
+} StoreWriter;
+
+/**
+ * what is printed of a topic; computed by the stats workers
+ */
+typedef struct TopicReport {
+	const MqStoreTopic* topic;
+	MqLatency latency;
+	MqSummary* phases; // w/ more than one phase
+	int num_phases;
+	const MqStream** streams; // of the topic, in the streams of the pool
+	int num_streams;
+	int computed;       // 0: failed or no worker got to it (see the log)
+} TopicReport;
+
+/**
+ * the topic reports to compute, handed out to the workers one at a time
+ */
+typedef struct StatsPool {
+	const MqStore* store;
+	TopicReport* reports;  // by name
+	TopicReport** order;   // largest topic first
+	int num_reports;
+	const MqStream** streams; // by topic
+	int next;              // into order
+	uint64_t max_samples;  // delays the workers hold at once, 0: any number
+	uint64_t reserved;     // of max_samples, held by the workers
+	pthread_mutex_t mutex; // reserved
+	pthread_cond_t released;
+} StatsPool;
+
+/**
+ * what a stats worker reuses from topic to topic
+ */
+typedef struct StatsScratch {
+	MqStoreCursor cursor;
+	long* uncorrected;     // delays from txtime
+	long* corrected;       // delays from intended txtime
+	uint64_t capacity;
+	MqHist hist[2];        // of the delays of topics w/ more than max_samples
+} StatsScratch;
 
 
 // -- file scoped globals (starts w/ mq_)
@@ -70,21 +204,33 @@ static sqlite3* mq_db = 0;
 
 static char* mq_create_sql = "CREATE TABLE stats "
                             "   (topic text not null,"
-		   	   	   	   	   	"    id integer not null,"
-        					"    tx_time_sec  integer not null,"
-		   	   	   	   	   	"    tx_time_usec integer not null,"
-        					"    rx_time_sec  integer not null,"
-		   	   	   	   	   	"    rx_time_usec integer not null,"
-		   	   	   	   	   	"    CONSTRAINT pk PRIMARY KEY (topic, id))";
+		   	   	   	   	   	"    producer integer not null,"
+		   	   	   	   	   	"    seq integer not null,"
+        					"    tx_time integer not null,"
+        					"    rx_time integer not null,"
+		   	   	   	   	   	"    phase integer not null,"
+        					"    intended_tx_time integer not null,"
+		   	   	   	   	   	"    CONSTRAINT pk PRIMARY KEY (topic, producer, seq))";
 
-static char* mq_insert_sql = "INSERT INTO stats VALUES (?,?,?,?,?,?)";
-static char* mq_select_sql = "SELECT * FROM stats WHERE topic=?";
-static char* mq_select_topic_names_sql = "SELECT topic FROM stats GROUP BY topic";
+static char* mq_insert_sql = "INSERT INTO stats VALUES (?,?,?,?,?,?,?)";
 
 
 static sqlite3_stmt* mq_insert_stmt = 0;
-static sqlite3_stmt* mq_select_stmt = 0;
-static sqlite3_stmt* mq_select_topic_names_stmt = 0;
+
+static MqClockSync mq_clocksync;
+
+static MqMessageCheck mq_check; // crc verification of the received payloads
+static MqStreamTable mq_streams;
+static MqReport mq_report; // latency: delay, jitter: |D| of consecutive messages
+static MqCapture mq_capture;
+static int64_t mq_kernel_rxtime = 0; // of the data the main loop is about to read, w/ -K
+static MqHist mq_kernel_delay;       // tx -> kernel rx
+static MqHist mq_rx_stack;           // kernel rx -> callback
+static StoreWriter mq_writer;
+static MqTopicTable mq_topics;       // owned by the network thread
+static int64_t mq_stats_nsec = 0;    // dump_stats from the store
+static int mq_stats_threads = 0;     // it took
+static char mq_clocksync_reply_topic[2 * MAX_TOPIC_NAME_LEN];
 
 /**
  * print_usage
@@ -96,6 +242,21 @@ static void print_usage () {
 			         "                 [-d <debuglevel> (0-3)]\n"
 			         "                 [-h <broker-host> (localhost)]\n"
 			         "                 [-p <broker-port> (1883)]\n"
+			         "                 [-o <control-topic> (estimate the clock offset of mqproducer -o)]\n"
+			         "                 [-O <resync-interval-secs> (10, 0: once at start)]\n"
+			         "                 [-k <clock> (realtime | monotonic | tsc)]\n"
+			         "                 [-i <report-interval-secs> (0: only at the end)]\n"
+			         "                 [-j (interval reports in JSON instead of CSV)]\n"
+			         "                 [-w <capture-file> (append every message, see mqanalyze)]\n"
+			         "                 [-W <capture-records> (16777216, the file is allocated up front)]\n"
+			         "                 [-K (kernel rx timestamps, time spent in the consumer's stack)]\n"
+			         "                 [-x <export-db> (also insert the samples into this sqlite db)]\n"
+			         "                 [-b <batch-rows> (1000, rows per export transaction)]\n"
+			         "                 [-B <batch-msec> (100, commit exported rows older than this)]\n"
+			         "                 [-s <stats-threads> (0: a thread per core, computing the report)]\n"
+			         "                 [-m <store-MiB> (0: unlimited, spill the samples to disk above this)]\n"
+			         "                 [-f <spill-dir> (., where the spill file is created)]\n"
+			         "                 [-R <ring-samples> (65536, the writer may fall behind by this many)]\n"
 				     "                 -? (prints out this usage)\n");
 }
 
@@ -111,8 +272,23 @@ static int parse_args(int ac, char** av) {
 	strncpy (mq_args.host_name, MOSQ_DEFAULT_HOST, MAX_HOST_NAME_LEN);
 	mq_args.port = MOSQ_DEFAULT_PORT;
 	mq_args.num_topic_types = 1;
-
-	while ((c = getopt(ac, av, "?t:q:d:h:p:n:")) != -1) {
+	memset(mq_args.control_topic, 0, MAX_TOPIC_NAME_LEN);
+	mq_args.resync_secs = MOSQ_DEFAULT_RESYNC_SECS;
+	strncpy (mq_args.clock, MQ_CLOCK_DEFAULT_SOURCE, MAX_CLOCK_NAME_LEN);
+	mq_args.report_secs = 0.0;
+	mq_args.report_json = 0;
+	memset(mq_args.capture_file, 0, MAX_FILE_NAME_LEN);
+	mq_args.capture_records = MQ_CAPTURE_DEFAULT_RECORDS;
+	mq_args.kernel_tstamps = 0;
+	memset(mq_args.export_file, 0, MAX_FILE_NAME_LEN);
+	mq_args.batch_rows = MOSQ_DB_DEFAULT_BATCH_ROWS;
+	mq_args.batch_msec = MOSQ_DB_DEFAULT_BATCH_MSEC;
+	mq_args.stats_threads = 0;
+	mq_args.store_mib = 0;
+	strncpy (mq_args.spill_dir, ".", MAX_FILE_NAME_LEN);
+	mq_args.ring_size = MOSQ_STORE_DEFAULT_RING_SIZE;
+
+	while ((c = getopt(ac, av, "?t:q:d:h:p:n:o:O:k:i:jw:W:Kx:b:B:s:m:f:R:")) != -1) {
 		switch (c) {
 		case '?':
 			print_usage();
@@ -137,6 +313,51 @@ static int parse_args(int ac, char** av) {
 		case 'n':
 			mq_args.num_topic_types = atoi (optarg);
 			break;
+		case 'o':
+			strncpy (mq_args.control_topic, optarg, MAX_TOPIC_NAME_LEN - 1);
+			break;
+		case 'O':
+			mq_args.resync_secs = atoi (optarg);
+			break;
+		case 'k':
+			strncpy (mq_args.clock, optarg, MAX_CLOCK_NAME_LEN - 1);
+			break;
+		case 'i':
+			mq_args.report_secs = atof (optarg);
+			break;
+		case 'j':
+			mq_args.report_json = 1;
+			break;
+		case 'w':
+			strncpy (mq_args.capture_file, optarg, MAX_FILE_NAME_LEN - 1);
+			break;
+		case 'W':
+			mq_args.capture_records = strtoull (optarg, 0, 10);
+			break;
+		case 'K':
+			mq_args.kernel_tstamps = 1;
+			break;
+		case 'x':
+			strncpy (mq_args.export_file, optarg, MAX_FILE_NAME_LEN - 1);
+			break;
+		case 'b':
+			mq_args.batch_rows = atoi (optarg);
+			break;
+		case 'B':
+			mq_args.batch_msec = atoi (optarg);
+			break;
+		case 's':
+			mq_args.stats_threads = atoi (optarg);
+			break;
+		case 'm':
+			mq_args.store_mib = atoi (optarg);
+			break;
+		case 'f':
+			strncpy (mq_args.spill_dir, optarg, MAX_FILE_NAME_LEN - 1);
+			break;
+		case 'R':
+			mq_args.ring_size = atoi (optarg);
+			break;
 		default:
 			mq_log_error ("'%c' %s",c, "unknown parameter!");
 			return -1;
@@ -153,6 +374,44 @@ static int parse_args(int ac, char** av) {
 		return -1;
 	}
 
+	if (mq_args.resync_secs < 0) {
+		mq_log_error ("%s", "Resync interval cannot be negative");
+		return -1;
+	}
+
+	if (mq_args.report_secs < 0) {
+		mq_log_error ("%s", "Report interval cannot be negative");
+		return -1;
+	}
+
+	if (mq_args.batch_rows <= 0 || mq_args.batch_msec < 0) {
+		mq_log_error ("%s", "Batch must be at least a row and cannot be negative msec");
+		return -1;
+	}
+
+	if (mq_args.store_mib < 0) {
+		mq_log_error ("%s", "Store budget cannot be negative");
+		return -1;
+	}
+
+	if (mq_args.ring_size <= 0 || mq_args.ring_size > MOSQ_STORE_MAX_RING_SIZE) {
+		mq_log_error ("Ring must be 1-%d samples", MOSQ_STORE_MAX_RING_SIZE);
+		return -1;
+	}
+
+	if (mq_args.stats_threads < 0) {
+		mq_log_error ("%s", "Stats threads cannot be negative");
+		return -1;
+	}
+	if (mq_args.stats_threads == 0) {
+		mq_args.stats_threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+		if (mq_args.stats_threads < 1) mq_args.stats_threads = 1;
+	}
+
+	if (mq_clock_init (mq_args.clock) == -1) {
+		return -1;
+	}
+
 	if (mq_args.num_topic_types <= 0) {
 		mq_log_warning ("Wrong number of topics (%d). "
 						"There must be at east one topic type. Assuming '1'!",
@@ -166,17 +425,20 @@ static int parse_args(int ac, char** av) {
 }
 
 
-static int db_init () {
+/**
+ * (re)creates the stats table in the export db
+ */
+static int db_init (const char* path) {
 
 	char *errmsg = 0;
 
-	// create database to collect data
-	if( sqlite3_open(MOSQ_SQLITE_DBNAME, &mq_db) != SQLITE_OK ){
-		mq_log_error ("Can't open database: %s\n", sqlite3_errmsg(mq_db));
+	if( sqlite3_open(path, &mq_db) != SQLITE_OK ){
+		mq_log_error ("Can't open database '%s': %s\n", path, sqlite3_errmsg(mq_db));
 		return -1;
 	}
 	// create table where topic statistics will be inserted
-	if( sqlite3_exec (mq_db, mq_create_sql, 0, 0, &errmsg) != SQLITE_OK ){
+	if( sqlite3_exec (mq_db, "DROP TABLE IF EXISTS stats", 0, 0, &errmsg) != SQLITE_OK ||
+		sqlite3_exec (mq_db, mq_create_sql, 0, 0, &errmsg) != SQLITE_OK ){
 		mq_log_error ("Can't create table: %s\n", sqlite3_errmsg(mq_db));
 		mq_log_error ("                    %s\n", errmsg);
 		sqlite3_free(errmsg);
@@ -186,46 +448,209 @@ static int db_init () {
 		mq_log_error ("Can't prepare insert statement: %s\n", sqlite3_errmsg(mq_db));
 		return -1;
 	}
-	if (sqlite3_prepare_v2 (mq_db, mq_select_sql, -1, &mq_select_stmt, 0) != SQLITE_OK) {
-		mq_log_error ("Can't prepare select statement: %s\n", sqlite3_errmsg(mq_db));
-		return -1;
-	}
 	return 0;
 }
 
 
-static int db_insert_msg (const struct mosquitto_message* msg) {
+/**
+ * inserts the row w/ its rx time (nsec, producer's clock)
+ */
+static int db_insert_row (const StoreRow* row) {
 
-	struct timeval rx_time = {0,0};
-	struct timeval tx_time = {0,0};
-	int mid = 0;
+	const MqCaptureRecord* m = &row->sample;
 	int rc = 0;
 
-	gettimeofday (&rx_time, 0); // current message rx time
-
 	// insert into db
-	mid = mq_message_id ((byte*)msg->payload);
-	tx_time =  mq_message_txtime ((byte*)msg->payload);
-
-	rc = sqlite3_bind_text (mq_insert_stmt, 1, msg->topic, -1, 0) == SQLITE_OK &&
-		 sqlite3_bind_int (mq_insert_stmt, 2, mid) == SQLITE_OK &&
-		 sqlite3_bind_int (mq_insert_stmt, 3, tx_time.tv_sec) == SQLITE_OK &&
-		 sqlite3_bind_int (mq_insert_stmt, 4, tx_time.tv_usec) == SQLITE_OK &&
-		 sqlite3_bind_int (mq_insert_stmt, 5, rx_time.tv_sec) == SQLITE_OK &&
-		 sqlite3_bind_int (mq_insert_stmt, 6, rx_time.tv_usec) == SQLITE_OK;
+	rc = sqlite3_bind_text (mq_insert_stmt, 1, row->topic, -1, 0) == SQLITE_OK &&
+		 sqlite3_bind_int64 (mq_insert_stmt, 2, m->producer) == SQLITE_OK &&
+		 sqlite3_bind_int64 (mq_insert_stmt, 3, (sqlite3_int64) m->seq) == SQLITE_OK &&
+		 sqlite3_bind_int64 (mq_insert_stmt, 4, m->txtime) == SQLITE_OK &&
+		 sqlite3_bind_int64 (mq_insert_stmt, 5, m->rxtime_tx) == SQLITE_OK &&
+		 sqlite3_bind_int (mq_insert_stmt, 6, m->phase) == SQLITE_OK &&
+		 sqlite3_bind_int64 (mq_insert_stmt, 7, m->intended_txtime) == SQLITE_OK;
 	if ( ! rc ) {
 		mq_log_error ("Can't bind params: %s\n", sqlite3_errmsg(mq_db));
 		return -1;
 	}
 	rc = sqlite3_step (mq_insert_stmt);
+	sqlite3_reset (mq_insert_stmt);
 	if (rc != SQLITE_DONE) {
 		mq_log_error ("Can't insert (%d): %s\n", rc, sqlite3_errmsg(mq_db));
+		return -1;
 	}
-	sqlite3_reset (mq_insert_stmt);
+	return 0;
+}
+
+static int db_exec (const char* sql) {
+
+	char *errmsg = 0;
 
+	if (sqlite3_exec (mq_db, sql, 0, 0, &errmsg) != SQLITE_OK) {
+		mq_log_error ("Can't execute '%s': %s\n", sql, errmsg);
+		sqlite3_free (errmsg);
+		return -1;
+	}
 	return 0;
 }
 
+static void* store_writer_run (void* arg) {
+
+	StoreWriter* w = (StoreWriter*) arg;
+	struct timespec idle = {0, MOSQ_STORE_IDLE_USEC * 1000};
+	int64_t batch_nsec = mq_args.batch_msec * 1000000LL;
+	int64_t batch_start = 0; // 0: no transaction open
+	int batch = 0;
+	int inserted = 0;        // rows of the open transaction
+	int64_t t0 = 0;
+	int64_t now = 0;
+	int stop = 0;
+	StoreRow row;
+
+	for (;;) {
+		// stop is set after the last push, so the ring is drained when it is seen
+		stop = __atomic_load_n (&w->stop, __ATOMIC_ACQUIRE);
+		if (mq_ring_pop (&w->ring, &row) == 0) {
+			t0 = mq_clock_now ();
+			if (mq_store_append (&w->store, row.topic_id, row.topic, &row.sample) == -1) {
+				w->failed++;
+			}
+			now = mq_clock_now ();
+			w->store_nsec += now - t0;
+			if (!mq_db) continue;
+
+			t0 = now;
+			if (!batch_start) {
+				if (db_exec ("BEGIN") == 0) {
+					batch_start = t0;
+				} else {
+					w->tx_failed++; // the row goes in on its own, BEGIN is tried again w/ the next one
+				}
+			}
+			if (db_insert_row (&row) == 0) {
+				w->rows++;
+				inserted++;
+			} else {
+				w->db_failed++;
+			}
+			batch++;
+			now = mq_clock_now ();
+			w->db_nsec += now - t0;
+			if (!batch_start) {
+				batch = 0;
+				inserted = 0;
+				continue;
+			}
+			if (batch < mq_args.batch_rows && now - batch_start < batch_nsec) {
+				continue;
+			}
+		} else if (!batch_start) {
+			if (stop) break;
+			nanosleep (&idle, 0);
+			continue;
+		} else if (!stop && mq_clock_now () - batch_start < batch_nsec) {
+			nanosleep (&idle, 0);
+			continue;
+		}
+		// a full or old batch, or the last one
+		t0 = mq_clock_now ();
+		if (db_exec ("COMMIT") == 0) {
+			mq_hist_record (&w->commit, mq_clock_now () - batch_start);
+			w->commits++;
+		} else {
+			// a failed COMMIT may leave the transaction open, its rows are lost either way
+			db_exec ("ROLLBACK");
+			w->tx_failed++;
+			w->rows -= inserted;
+			w->db_failed += inserted;
+		}
+		w->db_nsec += mq_clock_now () - t0;
+		batch_start = 0;
+		batch = 0;
+		inserted = 0;
+	}
+	w->end = mq_clock_now ();
+	return 0;
+}
+
+static int store_writer_start (StoreWriter* w) {
+	mq_store_init (&w->store, (size_t) mq_args.store_mib << 20, mq_args.spill_dir);
+	if (mq_ring_init (&w->ring, mq_args.ring_size, sizeof(StoreRow)) == -1 ||
+		mq_hist_init (&w->commit, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1) {
+		return -1;
+	}
+	w->start = mq_clock_now ();
+	if (pthread_create (&w->thread, 0, store_writer_run, w) != 0) {
+		mq_log_error ("Store writer thread cannot be created!");
+		return -1;
+	}
+	w->running = 1;
+	return 0;
+}
+
+/**
+ * waits until the writer stores (and exports) what is left in the ring
+ */
+static void store_writer_stop (StoreWriter* w) {
+	if (!w->running) return;
+	__atomic_store_n (&w->stop, 1, __ATOMIC_RELEASE);
+	pthread_join (w->thread, 0);
+	w->running = 0;
+}
+
+static void store_writer_destroy (StoreWriter* w) {
+	mq_ring_destroy (&w->ring);
+	mq_store_destroy (&w->store);
+	mq_hist_destroy (&w->commit);
+}
+
+/**
+ * memory of the store; w/ -x the sustained insert rate: rows over the time
+ * spent inserting, i.e. what the db could take, and over the run
+ */
+static void store_writer_dump (const StoreWriter* w) {
+
+	size_t bytes = mq_store_bytes (&w->store);
+	double busy = w->db_nsec / 1000000000.0;
+	double run = (w->end - w->start) / 1000000000.0;
+
+	printf ("Store -------------------------------------------------\n");
+	printf ("%llu samples of %d topics, %.1f MiB (%.1f bytes a sample), %.3f secs appending\n",
+			(unsigned long long) w->store.count, mq_topics.count, bytes / 1048576.0,
+			w->store.count ? (double) bytes / w->store.count : 0.0, w->store_nsec / 1000000000.0);
+	printf ("stats computed from the columns in %.3f msec on %d threads\n", mq_stats_nsec / 1000000.0,
+			mq_stats_threads);
+	if (w->store.num_spills > 0) {
+		printf ("%llu samples spilled to disk in %d spills, %.1f MiB, %.3f secs spilling; budget %d MiB\n",
+				(unsigned long long) w->store.spilled, w->store.num_spills, w->store.spill_size / 1048576.0,
+				w->store.spill_nsec / 1000000000.0, mq_args.store_mib);
+	}
+	if (w->store.spill_failed) {
+		printf ("spilling failed, samples beyond the budget were dropped (see the log)\n");
+	}
+	if (w->failed > 0) {
+		printf ("%" PRId64 " samples could not be stored\n", w->failed);
+	}
+	if (w->overruns > 0) {
+		printf ("%" PRId64 " samples dropped, store ring (%" PRIu64 ") full, see -R\n", w->overruns, w->ring.mask + 1);
+	}
+	if (!mq_db) return;
+
+	printf ("Export ------------------------------------------------\n");
+	printf ("%s: %" PRId64 " rows in %" PRId64 " transactions (%.1f rows each), %.0f rows/s sustained, "
+			"%.0f rows/s over %.3f secs, %.1f%% busy\n", mq_args.export_file,
+			w->rows, w->commits, w->commits ? (double) w->rows / w->commits : 0.0,
+			busy > 0 ? w->rows / busy : 0.0, run > 0 ? w->rows / run : 0.0, run,
+			run > 0 ? 100.0 * busy / run : 0.0);
+	if (w->db_failed > 0) {
+		printf ("%" PRId64 " rows could not be inserted\n", w->db_failed);
+	}
+	if (w->tx_failed > 0) {
+		printf ("%" PRId64 " transactions could not begin or commit (see the log)\n", w->tx_failed);
+	}
+	mq_hist_dump_header ("usec");
+	mq_hist_dump_row ("transaction", &w->commit, 1000.0);
+}
+
 
 /**
  * mq_connect_callback
@@ -271,12 +696,34 @@ static void mq_unsubscribe_callback(void *obj, uint16_t mid) {
 static void mq_on_message_callback(void *obj, const struct mosquitto_message* msg) {
 
 	static int zero_message_count = 0;
-	static int message_count = 0;
 
 	struct mosquitto* mosq = (struct mosquitto*) obj;
+	const MqMessageHeader* hdr = 0;
+	MqStream* stream = 0;
+	MqStreamArrival arrival = MQ_STREAM_IN_ORDER;
+	int64_t previous_transit = 0;
+	int64_t pairs = 0;
+	int64_t delay = 0;
+	int64_t rx_time = 0;
+	int64_t now = 0;
+	StoreRow row;
 
 	mq_log_debug ("mq_on_message_callback");
 
+	now = mq_clock_now (); // current message rx time
+	rx_time = now;
+
+	if (mq_args.control_topic[0]) {
+		if (strcmp (msg->topic, mq_clocksync_reply_topic) == 0) {
+			mq_clocksync_answer (&mq_clocksync, (const char*) msg->payload, msg->payloadlen, now / 1000);
+			return;
+		}
+		if (strncmp (msg->topic, mq_args.control_topic, strlen (mq_args.control_topic)) == 0 &&
+			msg->topic[strlen (mq_args.control_topic)] == '/') {
+			return; // control traffic of others matched by a wildcard subscription
+		}
+		now += 1000 * mq_clocksync_offset (&mq_clocksync, now / 1000);
+	}
 
 	if (msg->payloadlen == 0) {
 		// this is  a disconnect message!
@@ -287,121 +734,354 @@ static void mq_on_message_callback(void *obj, const struct mosquitto_message* ms
 		if (zero_message_count >= mq_args.num_topic_types) {
 			mosquitto_disconnect(mosq);
 		}
+	} else if ((hdr = mq_message_header (msg->payload, msg->payloadlen)) == 0) {
+		mq_log_warning ("Ignoring unknown message (%d bytes)", msg->payloadlen);
+	} else if (mq_message_check (&mq_check, hdr, msg->payloadlen) == -1) {
+		mq_log_warning ("Ignoring corrupt message on '%s'", msg->topic);
 	} else {
 
-		if ( db_insert_msg (msg) == -1 ) {
-			mq_log_error ("Message cannot be inserted into stats db!");
+		delay = now - mq_message_txtime (hdr);
+		stream = mq_stream_table_get (&mq_streams, mq_message_producer (hdr), 0, msg->topic);
+		if (stream) {
+			previous_transit = stream->last_transit;
+			pairs = stream->interarrival.count;
+			arrival = mq_stream_add (stream, mq_message_seq (hdr), delay, rx_time);
+			if (stream->interarrival.count > pairs) {
+				mq_hist_record (&mq_report.jitter, delay > previous_transit ?
+						delay - previous_transit : previous_transit - delay);
+			}
+		}
+		mq_capture_record_set (&row.sample, hdr, 0, msg->payloadlen, rx_time, now);
+		row.sample.kernel_rxtime = mq_kernel_rxtime;
+		if (mq_capture.hdr) {
+			row.sample.topic = mq_capture_topic (&mq_capture, msg->topic);
+			mq_capture_append (&mq_capture, &row.sample);
+		}
+		if (arrival != MQ_STREAM_DUPLICATE) {
+			mq_report_message (&mq_report, msg->payloadlen);
+			mq_hist_record (&mq_report.latency, delay);
+			if (mq_kernel_rxtime) {
+				mq_hist_record (&mq_kernel_delay, mq_kernel_rxtime + (now - rx_time) - mq_message_txtime (hdr));
+				mq_hist_record (&mq_rx_stack, rx_time - mq_kernel_rxtime);
+			}
+		}
+
+		if (arrival == MQ_STREAM_DUPLICATE) {
+			mq_log_debug ("Ignoring duplicate message %" PRIu64 " on '%s'", mq_message_seq (hdr), msg->topic);
+		} else if ((row.topic_id = mq_topic_id (&mq_topics, msg->topic)) == -1) {
+			mq_log_error ("Message on '%s' cannot be stored!", msg->topic);
 		} else {
-			message_count++;
+			row.topic = mq_topic_name (&mq_topics, row.topic_id);
+			if (mq_ring_push (&mq_writer.ring, &row) == -1) {
+				// the writer thread is behind, a stall here would skew the rx stamps
+				mq_writer.overruns++;
+			}
 		}
 	}
 }
 
 
-int dump_topic_stats (const char* topic_name) {
+/**
+ * frees the delay arrays of a worker and gives their share of the budget back
+ */
+static void stats_scratch_release (StatsPool* pool, StatsScratch* s) {
+	free (s->uncorrected);
+	free (s->corrected);
+	s->uncorrected = 0;
+	s->corrected = 0;
+	if (pool->max_samples > 0 && s->capacity > 0) {
+		pthread_mutex_lock (&pool->mutex);
+		pool->reserved -= s->capacity;
+		pthread_cond_broadcast (&pool->released);
+		pthread_mutex_unlock (&pool->mutex);
+	}
+	s->capacity = 0;
+}
 
-	int message_count = 0;
-	int jitter_count = 0;
+/**
+ * room for the delays of total samples. w/ a budget the worker gives up its
+ * arrays first and waits until the others leave it room, so the workers
+ * together never hold more than max_samples; w/o one the arrays are kept
+ * from topic to topic. on failure the worker holds neither arrays nor room
+ */
+static int stats_scratch_reserve (StatsPool* pool, StatsScratch* s, uint64_t total) {
 
-	MessageStat current_msg = {0,{0,0},{0,0}};
-	MessageStat previous_msg ={0,{0,0},{0,0}};
+	void* p = 0;
+	void* q = 0;
 
-	long current_rx_dt_usec = 0;
-	long current_tx_dt_usec = 0;
-	long previous_rx_dt_usec = 0;
-	long previous_tx_dt_usec = 0;
+	if (total <= s->capacity) return 0;
+	if (pool->max_samples > 0) {
+		stats_scratch_release (pool, s);
+		pthread_mutex_lock (&pool->mutex);
+		while (pool->reserved + total > pool->max_samples) {
+			pthread_cond_wait (&pool->released, &pool->mutex);
+		}
+		pool->reserved += total;
+		pthread_mutex_unlock (&pool->mutex);
+	}
+	s->capacity = total; // reserved
+	p = realloc (s->uncorrected, total * sizeof(long));
+	if (p) s->uncorrected = (long*) p;
+	q = realloc (s->corrected, total * sizeof(long));
+	if (q) s->corrected = (long*) q;
+	if (!p || !q) {
+		mq_log_error ("Memory for %llu delay samples cannot be allocated!", (unsigned long long) total);
+		// the arrays are no longer of a size, the reserved share goes back w/ them
+		stats_scratch_release (pool, s);
+		return -1;
+	}
+	return 0;
+}
 
-	long tx_jitter = 0;
-	long rx_jitter = 0;
-	long rx_min = LONG_MAX;
-	long tx_min = LONG_MAX;
-	long rx_max = LONG_MIN;
-	long tx_max = LONG_MIN;
-	double tx_avg = 0.0;
-	double rx_avg = 0.0;
+/**
+ * delay percentiles (and phases) of a topic, streamed through the cursor;
+ * from the delays themselves if there are at most max_samples of the pool
+ * (0: any number), from histograms otherwise
+ */
+static int topic_report_compute (TopicReport* r, StatsScratch* s, StatsPool* pool) {
+
+	const MqStoreTopic* t = r->topic;
+	uint64_t total = t->spilled + t->count;
+	int from_hist = pool->max_samples > 0 && total > pool->max_samples;
+	uint64_t n = 0;
+	uint64_t i = 0;
+	long uncorrected = 0;
+	long corrected = 0;
+	int rc = 0;
+
+	int phase = 0;
+	int num_phases = 1;
+	MqSummary dly_phase[MQ_MESSAGE_MAX_PHASES];
+
+	for (phase = 0; phase < MQ_MESSAGE_MAX_PHASES; phase++) {
+		mq_util_summary_init (&dly_phase[phase]);
+	}
 
-	if (sqlite3_bind_text (mq_select_stmt, 1, topic_name, -1, 0) != SQLITE_OK) {
-		mq_log_error ("Cannot bind topic name!");
+	if (from_hist) {
+		mq_hist_reset (&s->hist[0]);
+		mq_hist_reset (&s->hist[1]);
+	} else if (stats_scratch_reserve (pool, s, total) == -1) {
+		return -1;
+	}
+	mq_store_cursor_start (&s->cursor, t);
+	while ((rc = mq_store_cursor_next (&s->cursor)) == 1) {
+		for (i = 0; i < s->cursor.count; i++, n++) {
+			uncorrected = (s->cursor.rxtime[i] - s->cursor.txtime[i]) / 1000;
+			corrected = (s->cursor.rxtime[i] - s->cursor.intended_txtime[i]) / 1000;
+			if (from_hist) {
+				mq_hist_record (&s->hist[0], uncorrected);
+				mq_hist_record (&s->hist[1], corrected);
+			} else {
+				s->uncorrected[n] = uncorrected;
+				s->corrected[n] = corrected;
+			}
+			phase = s->cursor.phase[i];
+			mq_util_summary_add (&dly_phase[phase], uncorrected);
+			if (phase >= num_phases) num_phases = phase + 1;
+		}
+	}
+	if (rc == -1) {
 		return -1;
 	}
 
-	while (sqlite3_step(mq_select_stmt) == SQLITE_ROW) {
+	if (from_hist) {
+		mq_util_latency_from_hist (&r->latency, &s->hist[0], &s->hist[1]);
+	} else {
+		mq_util_latency_compute (&r->latency, s->uncorrected, s->corrected, (int) n);
+	}
 
-		current_msg.mid = sqlite3_column_int(mq_select_stmt, 1);
-		current_msg.tx_tv.tv_sec =  sqlite3_column_int(mq_select_stmt, 2);
-		current_msg.tx_tv.tv_usec =  sqlite3_column_int(mq_select_stmt, 3);
-		current_msg.rx_tv.tv_sec =  sqlite3_column_int(mq_select_stmt, 4);
-		current_msg.rx_tv.tv_usec =  sqlite3_column_int(mq_select_stmt, 5);
+	if (num_phases > 1) {
+		r->phases = (MqSummary*) malloc (num_phases * sizeof(MqSummary));
+		if (!r->phases) {
+			mq_log_error ("Memory for %d phases cannot be allocated!", num_phases);
+			return -1;
+		}
+		memcpy (r->phases, dly_phase, num_phases * sizeof(MqSummary));
+		r->num_phases = num_phases;
+	}
+	return 0;
+}
 
-		if (message_count > 0) {
-			/**
-			 * Take the difference of two packet tx/rx timestamps.
-			 * Since packet production rate is constant during a test session,
-			 * the difference of two consecutive packet timestamps gives us a relative delay,
-			 * including packet production rate.
-			 * Later we will use these relative delays to calculate the delay variations
-			 * by simply calculating their difference.
-			 * If everything were perfect, then (relative) delay variation (jitter) would be 0.
-			 */
+static void topic_report_dump (const TopicReport* r) {
 
-			current_rx_dt_usec = mq_util_timeval_diff_usec (current_msg.rx_tv, previous_msg.rx_tv);
-			current_tx_dt_usec = mq_util_timeval_diff_usec (current_msg.tx_tv, previous_msg.tx_tv);
+	int phase = 0;
 
-			if (message_count > 1) {
-				tx_jitter = previous_tx_dt_usec - current_tx_dt_usec;
-				rx_jitter = previous_rx_dt_usec - current_rx_dt_usec;
+	printf("'%s'\n", r->topic->name);
 
-				printf (" %6ld",        tx_jitter);
-				printf (" %6ld usec\n", rx_jitter);
+	mq_stream_dump (&mq_streams, r->streams, r->num_streams);
 
-				if (rx_jitter < rx_min) rx_min = rx_jitter;
-				if (rx_jitter > rx_max) rx_max = rx_jitter;
+	if (!r->computed) {
+		printf ("Latency cannot be computed (see the log)\n");
+		return;
+	}
+	mq_util_latency_dump (&r->latency);
 
-				if (tx_jitter < tx_min) tx_min = tx_jitter;
-				if (tx_jitter > tx_max) tx_max = tx_jitter;
+	for (phase = 0; phase < r->num_phases; phase++) {
+		if (r->phases[phase].count == 0) continue;
+		printf ("Phase %2d: %d samples, %ld / %ld / %6.2f usec\n", phase, r->phases[phase].count,
+				r->phases[phase].min, r->phases[phase].max, mq_util_summary_avg (&r->phases[phase]));
+	}
+}
 
-				tx_avg += labs(tx_jitter);
-				rx_avg += labs(rx_jitter);
+/**
+ * computes the reports the pool has left, the largest topics go first
+ */
+static void* stats_worker_run (void* arg) {
 
-				jitter_count++;
-			}
+	StatsPool* pool = (StatsPool*) arg;
+	StatsScratch scratch;
+	int i = 0;
 
-			previous_rx_dt_usec = current_rx_dt_usec;
-			previous_tx_dt_usec = current_tx_dt_usec;
+	memset (&scratch, 0, sizeof(scratch));
+	if (mq_store_cursor_init (&scratch.cursor, pool->store) == -1 ||
+		mq_hist_init (&scratch.hist[0], MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		mq_hist_init (&scratch.hist[1], MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1) {
+		goto cleanup; // the others take over
+	}
+	while ((i = __atomic_fetch_add (&pool->next, 1, __ATOMIC_RELAXED)) < pool->num_reports) {
+		pool->order[i]->computed = topic_report_compute (pool->order[i], &scratch, pool) == 0;
+		if (pool->max_samples > 0) {
+			stats_scratch_release (pool, &scratch);
 		}
+	}
+
+	/* CLEANUP LABEL*/
+	cleanup:
 
-		previous_msg = current_msg;
+	mq_store_cursor_destroy (&scratch.cursor);
+	mq_hist_destroy (&scratch.hist[0]);
+	mq_hist_destroy (&scratch.hist[1]);
+	stats_scratch_release (pool, &scratch);
+	return 0;
+}
 
-		message_count++;
-	}
-	tx_avg = tx_avg / jitter_count;
-	rx_avg = rx_avg / jitter_count;
+static int topic_name_compare (const void* a, const void* b) {
+	return strcmp (((const TopicReport*) a)->topic->name, ((const TopicReport*) b)->topic->name);
+}
+
+static int topic_size_compare (const void* a, const void* b) {
+	uint64_t x = (*(TopicReport* const*) a)->topic->count + (*(TopicReport* const*) a)->topic->spilled;
+	uint64_t y = (*(TopicReport* const*) b)->topic->count + (*(TopicReport* const*) b)->topic->spilled;
+	return x > y ? -1 : (x < y ? 1 : 0);
+}
 
-	sqlite3_reset(mq_select_stmt);
+static int stream_topic_compare (const void* a, const void* b) {
+	const MqStream* x = *(const MqStream* const*) a;
+	const MqStream* y = *(const MqStream* const*) b;
+	int c = strcmp (x->topic, y->topic);
+	// in the order of the table, as mq_stream_table_dump prints them
+	return c ? c : (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/**
+ * hands each report (sorted by name) the streams of its topic, sorting the
+ * streams by topic once instead of scanning the table for every topic
+ */
+static int stats_pool_group_streams (StatsPool* pool) {
 
-	printf ("Jitter ------------------------------------------------\n");
-	printf ("TX: %d messages, %4ld / %4ld / %6.2f usec\n", message_count, tx_min, tx_max, tx_avg);
-	printf ("RX: %d messages, %4ld / %4ld / %6.2f usec\n", message_count, rx_min, rx_max, rx_avg);
+	TopicReport* r = 0;
+	int num_streams = 0;
+	int i = 0;
+	int j = 0;
 
+	pool->streams = (const MqStream**) malloc ((mq_streams.count ? mq_streams.count : 1) * sizeof(MqStream*));
+	if (!pool->streams) {
+		mq_log_error ("Memory for %d streams cannot be allocated!", mq_streams.count);
+		return -1;
+	}
+	for (i = 0; i < mq_streams.capacity; i++) {
+		if (mq_streams.streams[i].topic) pool->streams[num_streams++] = mq_streams.streams + i;
+	}
+	qsort (pool->streams, num_streams, sizeof(MqStream*), stream_topic_compare);
+	for (i = 0, j = 0; i < pool->num_reports; i++) {
+		r = pool->reports + i;
+		while (j < num_streams && strcmp (pool->streams[j]->topic, r->topic->name) < 0) j++;
+		r->streams = pool->streams + j;
+		while (j < num_streams && strcmp (pool->streams[j]->topic, r->topic->name) == 0) {
+			r->num_streams++;
+			j++;
+		}
+	}
 	return 0;
 }
 
 void dump_stats() {
 
-	const char* topic_name = 0;
+	const MqStore* store = &mq_writer.store;
+	StatsPool pool;
+	pthread_t* threads = 0;
+	int num_threads = 0;
+	int64_t start = mq_clock_now ();
+	int i = 0;
+
+	memset (&pool, 0, sizeof(pool));
+	pool.store = store;
+	// the delays kept for the exact percentiles fit into the budget of the store. a topic
+	// gets exact percentiles if its delays fit alone, however many workers there are;
+	// the workers wait for each other's room
+	pool.max_samples = store->budget / (2 * sizeof(long));
+	if (store->budget > 0 && pool.max_samples == 0) pool.max_samples = 1;
+	pthread_mutex_init (&pool.mutex, 0);
+	pthread_cond_init (&pool.released, 0);
+	pool.reports = (TopicReport*) calloc (store->num_topics + 1, sizeof(TopicReport));
+	pool.order = (TopicReport**) calloc (store->num_topics + 1, sizeof(TopicReport*));
+	threads = (pthread_t*) calloc (mq_args.stats_threads, sizeof(pthread_t));
+	if (!pool.reports || !pool.order || !threads) {
+		mq_log_error ("Memory for %d topic reports cannot be allocated!", store->num_topics);
+		goto cleanup;
+	}
+	for (i = 0; i < store->num_topics; i++) {
+		if (store->topics[i].count + store->topics[i].spilled > 0) {
+			pool.reports[pool.num_reports++].topic = store->topics + i;
+		}
+	}
+	// printed by name, as the db used to group them
+	qsort (pool.reports, pool.num_reports, sizeof(TopicReport), topic_name_compare);
+	if (stats_pool_group_streams (&pool) == -1) {
+		goto cleanup;
+	}
+	for (i = 0; i < pool.num_reports; i++) {
+		pool.order[i] = pool.reports + i;
+	}
+	// computed largest first, so that a big topic does not start last and keep the others waiting
+	qsort (pool.order, pool.num_reports, sizeof(TopicReport*), topic_size_compare);
 
-	if (sqlite3_prepare_v2 (mq_db, mq_select_topic_names_sql, -1,
-			&mq_select_topic_names_stmt, 0) != SQLITE_OK) {
-		mq_log_error ("Can't prepare insert statement: %s\n", sqlite3_errmsg(mq_db));
-		return;
+	// this thread is one of the workers
+	for (num_threads = 1; num_threads < mq_args.stats_threads && num_threads < pool.num_reports; num_threads++) {
+		if (pthread_create (&threads[num_threads], 0, stats_worker_run, &pool) != 0) {
+			mq_log_warning ("Stats worker thread cannot be created, continuing w/ %d", num_threads);
+			break;
+		}
+	}
+	stats_worker_run (&pool);
+	for (i = 1; i < num_threads; i++) {
+		pthread_join (threads[i], 0);
 	}
-	while (sqlite3_step(mq_select_topic_names_stmt) == SQLITE_ROW) {
-		topic_name = (const char*) sqlite3_column_text(mq_select_topic_names_stmt, 0);
-		printf("'%s'\n", topic_name);
 
-		dump_topic_stats (topic_name);
+	for (i = 0; i < pool.num_reports; i++) {
+		topic_report_dump (pool.reports + i);
 	}
-	sqlite3_reset(mq_select_topic_names_stmt);
+
+	if (mq_rx_stack.total > 0) {
+		mq_hist_dump_header ("Kernel rx (usec)");
+		mq_hist_dump_row ("delay (kernel)", &mq_kernel_delay, 1000.0);
+		mq_hist_dump_row ("rx stack", &mq_rx_stack, 1000.0);
+	}
+	mq_stats_nsec = mq_clock_now () - start;
+	mq_stats_threads = num_threads;
+
+	/* CLEANUP LABEL*/
+	cleanup:
+
+	for (i = 0; pool.reports && i < pool.num_reports; i++) {
+		free (pool.reports[i].phases);
+	}
+	free (pool.reports);
+	free (pool.order);
+	free (pool.streams);
+	free (threads);
+	pthread_mutex_destroy (&pool.mutex);
+	pthread_cond_destroy (&pool.released);
 }
 
 
@@ -415,6 +1095,9 @@ int main (int ac, char** av) {
 	struct mosquitto* mosq = 0;
 	int result = MOSQ_ERR_SUCCESS;
 	uint16_t  smid = 0; // subscribe message id!
+	char clocksync_req_topic[MAX_TOPIC_NAME_LEN + 8];
+	char clocksync_req[MQ_CLOCKSYNC_MAX_MSG_LEN];
+	int64_t now = 0;
 
 	bname = strdup (basename(av[0]));
 	client_id = malloc (strlen(bname) + 16); // space for pid
@@ -429,7 +1112,16 @@ int main (int ac, char** av) {
 		// does not reach here!
 	}
 
-	if ( db_init () == -1 ) goto cleanup;
+	if ( mq_args.export_file[0] && db_init (mq_args.export_file) == -1 ) goto cleanup;
+	if ( store_writer_start (&mq_writer) == -1 ) goto cleanup;
+	if ( mq_stream_table_init (&mq_streams) == -1 ) goto cleanup;
+	if ( mq_report_init (&mq_report, mq_args.topic_name, mq_args.report_secs,
+			mq_args.report_json ? MQ_REPORT_JSON : MQ_REPORT_CSV, "delay", "jitter",
+			MQ_HIST_DEFAULT_SUB_BITS) == -1 ) goto cleanup;
+	if ( mq_hist_init (&mq_kernel_delay, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ||
+		 mq_hist_init (&mq_rx_stack, MQ_HIST_DEFAULT_SUB_BITS, MQ_HIST_DEFAULT_MAX_BITS) == -1 ) goto cleanup;
+	if ( mq_args.capture_file[0] &&
+		 mq_capture_create (&mq_capture, mq_args.capture_file, mq_args.capture_records, bname, mq_args.clock) == -1 ) goto cleanup;
 
 	mq_log_info ("This subscriber id is '%s'", client_id);
 
@@ -461,22 +1153,91 @@ int main (int ac, char** av) {
 	}
 	mq_log_info ("Subscribed with message id %d",smid);
 
+	if (mq_args.kernel_tstamps && mq_tstamp_enable_rx (mosquitto_socket (mosq)) == -1) {
+		goto cleanup;
+	}
+
+	mq_clocksync_init (&mq_clocksync, mq_args.resync_secs);
+	if (mq_args.control_topic[0]) {
+		snprintf (clocksync_req_topic, sizeof(clocksync_req_topic), "%s/req", mq_args.control_topic);
+		snprintf (mq_clocksync_reply_topic, sizeof(mq_clocksync_reply_topic), "%s/rep/%s",
+				mq_args.control_topic, client_id);
+		result = mosquitto_subscribe (mosq, 0, mq_clocksync_reply_topic, 0);
+		if (result != MOSQ_ERR_SUCCESS) {
+			mq_util_print_error (result);
+			goto cleanup;
+		}
+	}
+
+	if (mq_args.report_secs > 0) {
+		mq_report_header (mq_args.report_json ? MQ_REPORT_JSON : MQ_REPORT_CSV, "delay", "jitter");
+	}
+	mq_report_start (&mq_report, mq_clock_now ());
+
 	do {
 
-		result = mosquitto_loop(mosq,MOSQ_LOOP_TIMEOUT);
+		if (mq_args.kernel_tstamps) {
+			// wait here, so that the stamp is of what mosquitto_loop reads next
+			mq_kernel_rxtime = mq_tstamp_wait_rx (mosquitto_socket (mosq), mosquitto_want_write (mosq),
+					MOSQ_LOOP_TIMEOUT);
+			result = mosquitto_loop(mosq, 0);
+		} else {
+			result = mosquitto_loop(mosq,MOSQ_LOOP_TIMEOUT);
+		}
+
+		now = mq_clock_now ();
+		if (mq_report_due (&mq_report, now)) {
+			mq_report_emit (&mq_report, now, mq_stream_table_lost (&mq_streams));
+		}
+
+		if (result == MOSQ_ERR_SUCCESS && mq_args.control_topic[0] &&
+			mq_clocksync_poll (&mq_clocksync, now / 1000, mq_clocksync_reply_topic,
+					clocksync_req, sizeof(clocksync_req))) {
+			result = mosquitto_publish (mosq, 0, clocksync_req_topic, strlen (clocksync_req),
+					(uint8_t*) clocksync_req, 0, false);
+		}
 
 	} while (result == MOSQ_ERR_SUCCESS);
 
+	// the rows still in the ring are inserted before the stats are read
+	store_writer_stop (&mq_writer);
+
+	if (mq_args.report_secs > 0) {
+		mq_report_emit (&mq_report, mq_clock_now (), mq_stream_table_lost (&mq_streams)); // the last, partial interval
+	}
 	dump_stats();
 	printf ("\n");
+	store_writer_dump (&mq_writer);
+	printf ("\n");
+	if (mq_args.control_topic[0]) {
+		mq_clocksync_dump (&mq_clocksync);
+	}
+	mq_message_check_dump (&mq_check);
+	mq_clock_dump ();
+	if (mq_capture.hdr) {
+		printf ("%llu messages captured to '%s'", (unsigned long long) mq_capture.count, mq_args.capture_file);
+		if (mq_capture.dropped > 0) {
+			printf (", %lld did not fit", (long long) mq_capture.dropped);
+		}
+		printf ("\n");
+	}
 
 	/* CLEANUP LABEL*/
 	cleanup:
 
+	store_writer_stop (&mq_writer);
+	store_writer_destroy (&mq_writer);
+	mq_topic_table_destroy (&mq_topics);
 	if (mq_db) {
+		sqlite3_finalize (mq_insert_stmt);
 		sqlite3_close(mq_db);
 		mq_db = 0;
 	}
+	mq_stream_table_destroy (&mq_streams);
+	mq_report_destroy (&mq_report);
+	mq_hist_destroy (&mq_kernel_delay);
+	mq_hist_destroy (&mq_rx_stack);
+	mq_capture_close (&mq_capture);
 	if (mosq) {
 		mosquitto_destroy (mosq);
 		mosquitto_lib_cleanup();